@@ -7,9 +7,9 @@ syn match cirnoInteger '[-+]\d\+'
 
 syn region cirnoString start='"' end='"'
 
-syn keyword cirnoFunction fn
-syn keyword cirnoStatement if while return break else asm
-syn keyword cirnoType i8 i32 struct
+syn keyword cirnoFunction fn extern
+syn keyword cirnoStatement if while return break else asm par reduce
+syn keyword cirnoType i8 i32 region struct
 
 hi def link cirnoFunction Function
 hi def link cirnoStatement Statement
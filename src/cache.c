@@ -0,0 +1,320 @@
+#include "cache.h"
+
+#include "cc/frag.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FNV_BASIS 14695981039346656037ul
+#define FNV_PRIME 1099511628211ul
+
+static cache_key_t hash_bytes(cache_key_t key, const char *buf, long len)
+{
+  for (long i = 0; i < len; i++) {
+    key ^= (unsigned char) buf[i];
+    key *= FNV_PRIME;
+  }
+  
+  return key;
+}
+
+static char *read_file(const char *fname, long *len)
+{
+  FILE *in = fopen(fname, "rb");
+  if (!in)
+    return NULL;
+  
+  fseek(in, 0, SEEK_END);
+  *len = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  
+  char *buf = malloc(*len + 1);
+  
+  if (fread(buf, 1, *len, in) != (size_t) *len) {
+    free(buf);
+    buf = NULL;
+  } else {
+    buf[*len] = '\0';
+  }
+  
+  fclose(in);
+  
+  return buf;
+}
+
+static char *include_path(const char *fname, const char *name, int len)
+{
+  const char *slash = strrchr(fname, '/');
+  int dir_len = slash ? slash - fname + 1 : 0;
+  
+  char *path = malloc(dir_len + len + 1);
+  memcpy(path, fname, dir_len);
+  memcpy(path + dir_len, name, len);
+  path[dir_len + len] = '\0';
+  
+  return path;
+}
+
+static int hash_source(cache_key_t *key, const char *fname, int depth)
+{
+  if (depth > CACHE_DEPTH)
+    return 0;
+  
+  long len;
+  char *buf = read_file(fname, &len);
+  if (!buf)
+    return 0;
+  
+  *key = hash_bytes(*key, fname, strlen(fname) + 1);
+  *key = hash_bytes(*key, buf, len);
+  
+  int ok = 1;
+  char *c = buf;
+  
+  while (ok && *c) {
+    if (c[0] == '/' && c[1] == '/') {
+      while (*c && *c != '\n')
+        c++;
+    } else if (c[0] == '/' && c[1] == '*') {
+      c += 2;
+      while (*c && c[0] != '*' && c[1] != '/')
+        c++;
+      if (*c)
+        c++;
+      if (*c)
+        c++;
+    } else if (*c == '"' || *c == '\'') {
+      char quote = *c++;
+      while (*c && *c != quote)
+        c += c[0] == '\\' && c[1] ? 2 : 1;
+      if (*c)
+        c++;
+    } else if (strncmp(c, "#include \"", 10) == 0) {
+      char *name = c + 10;
+      char *end = strchr(name, '"');
+      if (!end)
+        break;
+      
+      char *path = include_path(fname, name, end - name);
+      ok = hash_source(key, path, depth + 1);
+      free(path);
+      
+      c = end + 1;
+    } else {
+      c++;
+    }
+  }
+  
+  free(buf);
+  
+  return ok;
+}
+
+static cache_key_t cache_stamp(int flags)
+{
+  cache_key_t key = FNV_BASIS;
+  
+  int head[] = { CACHE_VERSION, flags };
+  key = hash_bytes(key, (char*) head, sizeof(head));
+  key = hash_bytes(key, __DATE__ __TIME__, sizeof(__DATE__ __TIME__));
+  
+  return key;
+}
+
+cache_key_t cache_key(const char *fname, int flags)
+{
+  cache_key_t key = cache_stamp(flags);
+  
+  if (!hash_source(&key, fname, 0))
+    return 0;
+  
+  return key;
+}
+
+static char *cache_path(const char *fname, const char *ext, int f_mkdir)
+{
+  const char *slash = strrchr(fname, '/');
+  const char *base = slash ? slash + 1 : fname;
+  
+  int base_len = strlen(base);
+  if (base_len > 3 && strcmp(base + base_len - 3, ".9c") == 0)
+    base_len -= 3;
+  
+  char *path = include_path(fname, CACHE_DIR, strlen(CACHE_DIR));
+  
+  if (f_mkdir && mkdir(path, 0777) < 0 && access(path, W_OK) < 0) {
+    free(path);
+    return NULL;
+  }
+  
+  int dir_len = strlen(path);
+  path = realloc(path, dir_len + base_len + strlen(ext) + 2);
+  sprintf(path + dir_len, "/%.*s%s", base_len, base, ext);
+  
+  return path;
+}
+
+bin_t *cache_read(const char *fname, cache_key_t key)
+{
+  char *path = cache_path(fname, ".bin", 0);
+  
+  FILE *in = fopen(path, "rb");
+  
+  bin_t *bin = NULL;
+  cache_key_t file_key;
+  
+  if (in && fread(&file_key, sizeof(file_key), 1, in) == 1 && file_key == key)
+    bin = bin_map(path, sizeof(file_key));
+  
+  if (in)
+    fclose(in);
+  
+  free(path);
+  
+  return bin;
+}
+
+static FILE *cache_open(char *path, char **tmp)
+{
+  *tmp = malloc(strlen(path) + 16);
+  sprintf(*tmp, "%s.%i", path, getpid());
+  
+  return fopen(*tmp, "wb");
+}
+
+static void cache_close(FILE *out, char *path, char *tmp)
+{
+  if (fclose(out) == 0)
+    rename(tmp, path);
+  else
+    remove(tmp);
+}
+
+void cache_write(const char *fname, cache_key_t key, bin_t *bin)
+{
+  char *path = cache_path(fname, ".bin", 1);
+  if (!path)
+    return;
+  
+  char *tmp;
+  FILE *out = cache_open(path, &tmp);
+  
+  if (out) {
+    fwrite(&key, sizeof(key), 1, out);
+    bin_write(bin, out, 0);
+    cache_close(out, path, tmp);
+  }
+  
+  free(tmp);
+  free(path);
+}
+
+static FILE *cache_load(const char *fname, const char *ext, cache_key_t key, char **buf)
+{
+  char *path = cache_path(fname, ext, 0);
+  
+  long len;
+  *buf = read_file(path, &len);
+  
+  free(path);
+  
+  if (!*buf)
+    return NULL;
+  
+  cache_key_t head[2];
+  
+  if (len >= (long) sizeof(head)) {
+    memcpy(head, *buf, sizeof(head));
+    
+    if (head[0] == key && head[1] == hash_bytes(FNV_BASIS, *buf + sizeof(head), len - sizeof(head))) {
+      FILE *in = fmemopen(*buf + sizeof(head), len - sizeof(head), "rb");
+      if (in)
+        return in;
+    }
+  }
+  
+  free(*buf);
+  
+  return NULL;
+}
+
+static void cache_store(const char *fname, const char *ext, cache_key_t key, char *buf, size_t len)
+{
+  char *path = cache_path(fname, ext, 1);
+  if (!path)
+    return;
+  
+  cache_key_t head[] = { key, hash_bytes(FNV_BASIS, buf, len) };
+  
+  char *tmp;
+  FILE *out = cache_open(path, &tmp);
+  
+  if (out) {
+    fwrite(head, sizeof(head), 1, out);
+    fwrite(buf, 1, len, out);
+    cache_close(out, path, tmp);
+  }
+  
+  free(tmp);
+  free(path);
+}
+
+void cache_read_frag(const char *fname)
+{
+  char *buf;
+  FILE *in = cache_load(fname, ".fn", cache_stamp(0), &buf);
+  
+  if (!in)
+    return;
+  
+  frag_read(in);
+  
+  fclose(in);
+  free(buf);
+}
+
+void cache_write_frag(const char *fname)
+{
+  char *buf;
+  size_t len;
+  
+  FILE *mem = open_memstream(&buf, &len);
+  frag_write(mem);
+  fclose(mem);
+  
+  cache_store(fname, ".fn", cache_stamp(0), buf, len);
+  
+  free(buf);
+}
+
+int cache_read_pch(const char *fname, cache_key_t key)
+{
+  char *buf;
+  FILE *in = cache_load(fname, ".ph", key, &buf);
+  
+  if (!in)
+    return 0;
+  
+  int ok = pch_read(in) ? 1 : -1;
+  
+  fclose(in);
+  free(buf);
+  
+  return ok;
+}
+
+void cache_write_pch(const char *fname, cache_key_t key, pch_t *pch)
+{
+  char *buf;
+  size_t len;
+  
+  FILE *mem = open_memstream(&buf, &len);
+  pch_write(mem, pch);
+  fclose(mem);
+  
+  cache_store(fname, ".ph", key, buf, len);
+  
+  free(buf);
+}
@@ -0,0 +1,21 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "vm/bin.h"
+#include "cc/pch.h"
+
+#define CACHE_DIR "__cirno__"
+#define CACHE_VERSION 8
+#define CACHE_DEPTH 32
+
+typedef unsigned long cache_key_t;
+
+cache_key_t cache_key(const char *fname, int flags);
+bin_t *cache_read(const char *fname, cache_key_t key);
+void cache_write(const char *fname, cache_key_t key, bin_t *bin);
+void cache_read_frag(const char *fname);
+void cache_write_frag(const char *fname);
+int cache_read_pch(const char *fname, cache_key_t key);
+void cache_write_pch(const char *fname, cache_key_t key, pch_t *pch);
+
+#endif
@@ -0,0 +1,877 @@
+#include "p_local.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define MAX_REASON 128
+
+typedef enum effect_e effect_t;
+typedef struct access_s access_t;
+
+enum effect_e {
+  EFFECT_NONE,
+  EFFECT_READ,
+  EFFECT_WRITE
+};
+
+struct access_s {
+  expr_t *expr;
+  decl_t *obj;
+  decl_t *ptr;
+  taddr_t taddr;
+  int f_write;
+  int f_reduce;
+  int f_private;
+  int f_defined;
+  int f_index;
+  int f_other;
+  int scale;
+  int offset;
+  int size;
+  access_t *next;
+};
+
+struct loop_s {
+  char *fname;
+  int line;
+  taddr_t taddr;
+  int local_lo;
+  int local_hi;
+  decl_t *decl;
+  func_t *func;
+  stmt_t *stmt;
+  int f_par;
+  loop_t *outer;
+  expr_t *reduce;
+  decl_t *reduce_obj;
+  char reason[MAX_REASON];
+  loop_t *next;
+};
+
+static int f_enabled = 0;
+
+static loop_t *loop_body = NULL;
+static loop_t *loop_head = NULL;
+
+static unit_t *cur_unit;
+static loop_t *cur_loop;
+static expr_t *cur_var;
+static decl_t *cur_var_obj;
+static access_t *access_list;
+static func_t *read_func;
+static int cond_depth;
+
+static func_t **visit_func;
+static int num_visit_func;
+static int max_visit_func;
+
+static void reject(const char *fmt, ...);
+static void walk_stmt(stmt_t *stmt, loop_t *outer);
+static void scan_stmt(stmt_t *stmt);
+static void scan_expr(expr_t *expr);
+static effect_t func_effect(func_t *func);
+static effect_t stmt_effect(stmt_t *stmt);
+static effect_t expr_effect(expr_t *expr);
+static int count_stmt(stmt_t *stmt, taddr_t taddr, int lo, int hi, int f_addr);
+static int count_expr(expr_t *expr, taddr_t taddr, int lo, int hi, int f_addr);
+
+void autopar_init(int f_autopar)
+{
+  f_enabled = f_autopar;
+  loop_body = NULL;
+  loop_head = NULL;
+}
+
+loop_t *autopar_begin()
+{
+  if (!f_enabled)
+    return NULL;
+  
+  loop_t *loop = malloc(sizeof(loop_t));
+  loop->fname = strdup(lex.fid->fname);
+  loop->line = lex.fid->line_no;
+  loop->taddr = current_scope->taddr;
+  current_scope->size = (current_scope->size + 3) & ~3;
+  loop->local_lo = current_scope->size;
+  loop->local_hi = current_scope->size;
+  loop->decl = NULL;
+  loop->func = current_func;
+  loop->stmt = NULL;
+  loop->f_par = 0;
+  loop->outer = NULL;
+  loop->reduce = NULL;
+  loop->reduce_obj = NULL;
+  loop->reason[0] = '\0';
+  loop->next = NULL;
+  
+  if (loop_body)
+    loop_head = loop_head->next = loop;
+  else
+    loop_body = loop_head = loop;
+  
+  return loop;
+}
+
+void autopar_end(loop_t *loop, stmt_t *stmt)
+{
+  loop->local_hi = current_scope->size;
+  loop->decl = current_scope->decl;
+  loop->stmt = stmt;
+  stmt->while_stmt.loop = loop;
+}
+
+static void reject(const char *fmt, ...)
+{
+  if (cur_loop->reason[0])
+    return;
+  
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(cur_loop->reason, MAX_REASON, fmt, args);
+  va_end(args);
+}
+
+static decl_t *find_decl(taddr_t taddr, int offset)
+{
+  decl_t *decl = taddr == cur_loop->taddr ? cur_loop->decl : scope_global->decl;
+  
+  while (decl) {
+    if (offset >= decl->offset && offset < decl->offset + type_size(decl->type.spec, decl->type.dcltr))
+      return decl;
+    decl = decl->prev;
+  }
+  
+  return NULL;
+}
+
+static char *decl_name(decl_t *decl)
+{
+  return decl ? hash_get(decl->name) : "memory";
+}
+
+static int is_var(expr_t *expr, expr_t *var)
+{
+  return expr->texpr == EXPR_LOAD
+  && expr->addr.taddr == var->addr.taddr
+  && expr->addr.base->texpr == EXPR_CONST
+  && expr->addr.base->num == var->addr.base->num;
+}
+
+static int is_private(decl_t *decl, taddr_t taddr)
+{
+  return decl
+  && taddr == cur_loop->taddr
+  && decl->offset >= cur_loop->local_lo
+  && decl->offset < cur_loop->local_hi;
+}
+
+static int is_scalar(decl_t *decl)
+{
+  if (decl->type.dcltr)
+    return decl->type.dcltr->type == DCLTR_POINTER;
+  
+  return decl->type.spec->tspec != TY_STRUCT;
+}
+
+static expr_t *addr_root(expr_t *base)
+{
+  while (base->texpr == EXPR_BINOP && base->binop.op == OPERATOR_ADD)
+    base = base->binop.lhs;
+  
+  return base;
+}
+
+static void add_index(access_t *access, int scale)
+{
+  if (access->f_index)
+    access->f_other = 1;
+  
+  access->f_index = 1;
+  access->scale = scale;
+}
+
+static void split_addr(expr_t *expr, expr_t **root, access_t *access)
+{
+  if (expr->texpr == EXPR_BINOP && expr->binop.op == OPERATOR_ADD) {
+    split_addr(expr->binop.lhs, root, access);
+    split_addr(expr->binop.rhs, root, access);
+  } else if (expr->texpr == EXPR_CONST) {
+    if (*root)
+      access->offset += expr->num;
+    else
+      *root = expr;
+  } else if (!*root && expr->type.dcltr && expr->type.dcltr->type == DCLTR_POINTER) {
+    *root = expr;
+  } else if (is_var(expr, cur_var)) {
+    add_index(access, 1);
+  } else if (expr->texpr == EXPR_BINOP
+  && expr->binop.op == OPERATOR_MUL
+  && expr->binop.rhs->texpr == EXPR_CONST
+  && is_var(expr->binop.lhs, cur_var)) {
+    add_index(access, expr->binop.rhs->num);
+  } else {
+    access->f_other = 1;
+  }
+}
+
+static access_t *find_access(decl_t *obj, int f_write, int f_defined)
+{
+  for (access_t *access = access_list; access; access = access->next) {
+    if (access->obj == obj && access->f_write == f_write && access->f_defined >= f_defined)
+      return access;
+  }
+  
+  return NULL;
+}
+
+static void add_access(expr_t *expr, int f_write, int f_reduce)
+{
+  access_t *access = calloc(1, sizeof(access_t));
+  access->expr = expr;
+  access->taddr = expr->addr.taddr;
+  access->f_write = f_write;
+  access->f_reduce = f_reduce;
+  access->size = type_size(expr->type.spec, expr->type.dcltr);
+  
+  expr_t *root = NULL;
+  split_addr(expr->addr.base, &root, access);
+  
+  if (root && root->texpr == EXPR_CONST) {
+    access->obj = find_decl(expr->addr.taddr, root->num);
+    if (access->obj)
+      access->offset += root->num - access->obj->offset;
+  } else if (root
+  && root->texpr == EXPR_LOAD
+  && root->addr.base->texpr == EXPR_CONST) {
+    decl_t *ptr = find_decl(root->addr.taddr, root->addr.base->num);
+    if (!is_private(ptr, root->addr.taddr)) {
+      access->ptr = ptr;
+      access->taddr = root->addr.taddr;
+    }
+  }
+  
+  if (access->obj && access->obj == cur_var_obj) {
+    if (f_write)
+      reject("modifies the loop variable '%s'", decl_name(cur_var_obj));
+    free(access);
+    return;
+  }
+  
+  if (is_private(access->obj, access->taddr)) {
+    access->f_private = 1;
+    
+    if (is_scalar(access->obj)) {
+      if (f_write) {
+        access->f_defined = cond_depth == 0;
+      } else if (!find_access(access->obj, 1, 1)) {
+        reject("'%s' may be read before it is set", decl_name(access->obj));
+      }
+    }
+  }
+  
+  access->next = access_list;
+  access_list = access;
+}
+
+static void take_addr(expr_t *expr)
+{
+  expr_t *root = addr_root(expr->addr.base);
+  
+  decl_t *obj = NULL;
+  if (root->texpr == EXPR_CONST)
+    obj = find_decl(expr->addr.taddr, root->num);
+  
+  if (obj && is_private(obj, expr->addr.taddr))
+    return;
+  
+  if (obj)
+    reject("takes the address of '%s'", decl_name(obj));
+  else
+    reject("takes an address");
+}
+
+static int is_reduce(expr_t *expr)
+{
+  expr_t *lhs = expr->binop.lhs;
+  expr_t *rhs = expr->binop.rhs;
+  
+  if (!is_par_var(lhs) || is_var(lhs, cur_var))
+    return 0;
+  
+  decl_t *obj = find_decl(lhs->addr.taddr, lhs->addr.base->num);
+  if (!obj || is_private(obj, lhs->addr.taddr))
+    return 0;
+  
+  return rhs->texpr == EXPR_BINOP
+  && rhs->binop.op == OPERATOR_ADD
+  && is_var(rhs->binop.lhs, lhs);
+}
+
+static void scan_expr(expr_t *expr)
+{
+  while (expr) {
+    switch (expr->texpr) {
+    case EXPR_LOAD:
+      scan_expr(expr->addr.base);
+      if (expr->type.dcltr && expr->type.dcltr->type == DCLTR_ARRAY)
+        take_addr(expr);
+      else
+        add_access(expr, 0, 0);
+      break;
+    case EXPR_ADDR:
+      scan_expr(expr->addr.base);
+      take_addr(expr);
+      break;
+    case EXPR_BINOP:
+      if (expr->binop.op == OPERATOR_ASSIGN) {
+        if (is_reduce(expr)) {
+          scan_expr(expr->binop.rhs->binop.rhs);
+          add_access(expr->binop.lhs, 1, 1);
+        } else {
+          scan_expr(expr->binop.rhs);
+          scan_expr(expr->binop.lhs->addr.base);
+          add_access(expr->binop.lhs, 1, 0);
+        }
+      } else {
+        scan_expr(expr->binop.lhs);
+        scan_expr(expr->binop.rhs);
+      }
+      break;
+    case EXPR_CALL:
+      scan_expr(expr->post.post);
+      
+      num_visit_func = 0;
+      func_t *func = expr->post.base->func.func;
+      effect_t effect = func_effect(func);
+      
+      if (effect == EFFECT_WRITE)
+        reject("calls '%s', which has side effects", hash_get(func->name));
+      else if (effect == EFFECT_READ && !read_func)
+        read_func = func;
+      break;
+    case EXPR_ARG:
+      scan_expr(expr->arg.base);
+      scan_expr(expr->arg.next);
+      break;
+    case EXPR_CAST:
+      scan_expr(expr->unary.base);
+      break;
+    default:
+      break;
+    }
+    
+    expr = expr->next;
+  }
+}
+
+static void scan_stmt(stmt_t *stmt)
+{
+  while (stmt) {
+    switch (stmt->tstmt) {
+    case STMT_EXPR:
+      scan_expr(stmt->expr);
+      break;
+    case STMT_IF:
+      scan_expr(stmt->if_stmt.cond);
+      cond_depth++;
+      scan_stmt(stmt->if_stmt.body);
+      scan_stmt(stmt->if_stmt.next_if);
+      scan_stmt(stmt->if_stmt.else_body);
+      cond_depth--;
+      break;
+    case STMT_WHILE:
+      cond_depth++;
+      scan_expr(stmt->while_stmt.cond);
+      scan_stmt(stmt->while_stmt.body);
+      cond_depth--;
+      break;
+    case STMT_RETURN:
+      reject("returns from inside the loop");
+      break;
+    case STMT_INLINE_ASM:
+      reject("contains inline assembly");
+      break;
+    case STMT_PAR:
+      reject("contains a par while");
+      break;
+    }
+    
+    stmt = stmt->next;
+  }
+}
+
+static effect_t func_effect(func_t *func)
+{
+  if (func->native >= 0 || func->intrinsic >= 0 || !func->body)
+    return EFFECT_WRITE;
+  
+  for (int i = 0; i < num_visit_func; i++) {
+    if (visit_func[i] == func)
+      return EFFECT_NONE;
+  }
+  
+  if (num_visit_func == max_visit_func) {
+    max_visit_func = max_visit_func ? max_visit_func * 2 : 16;
+    visit_func = realloc(visit_func, max_visit_func * sizeof(func_t*));
+  }
+  
+  visit_func[num_visit_func++] = func;
+  
+  return stmt_effect(func->body);
+}
+
+static effect_t max_effect(effect_t a, effect_t b)
+{
+  return a > b ? a : b;
+}
+
+static effect_t expr_effect(expr_t *expr)
+{
+  effect_t effect = EFFECT_NONE;
+  
+  while (expr) {
+    switch (expr->texpr) {
+    case EXPR_LOAD:
+    case EXPR_ADDR:
+      effect = max_effect(effect, expr_effect(expr->addr.base));
+      if (expr->texpr == EXPR_LOAD && expr->addr.taddr == ADDR_GLOBAL)
+        effect = max_effect(effect, EFFECT_READ);
+      break;
+    case EXPR_BINOP:
+      if (expr->binop.op == OPERATOR_ASSIGN && expr->binop.lhs->addr.taddr == ADDR_GLOBAL)
+        effect = EFFECT_WRITE;
+      effect = max_effect(effect, expr_effect(expr->binop.lhs));
+      effect = max_effect(effect, expr_effect(expr->binop.rhs));
+      break;
+    case EXPR_CALL:
+      effect = max_effect(effect, expr_effect(expr->post.post));
+      effect = max_effect(effect, func_effect(expr->post.base->func.func));
+      break;
+    case EXPR_ARG:
+      effect = max_effect(effect, expr_effect(expr->arg.base));
+      effect = max_effect(effect, expr_effect(expr->arg.next));
+      break;
+    case EXPR_CAST:
+      effect = max_effect(effect, expr_effect(expr->unary.base));
+      break;
+    default:
+      break;
+    }
+    
+    expr = expr->next;
+  }
+  
+  return effect;
+}
+
+static effect_t stmt_effect(stmt_t *stmt)
+{
+  effect_t effect = EFFECT_NONE;
+  
+  while (stmt) {
+    switch (stmt->tstmt) {
+    case STMT_EXPR:
+      effect = max_effect(effect, expr_effect(stmt->expr));
+      break;
+    case STMT_IF:
+      effect = max_effect(effect, expr_effect(stmt->if_stmt.cond));
+      effect = max_effect(effect, stmt_effect(stmt->if_stmt.body));
+      effect = max_effect(effect, stmt_effect(stmt->if_stmt.next_if));
+      effect = max_effect(effect, stmt_effect(stmt->if_stmt.else_body));
+      break;
+    case STMT_WHILE:
+      effect = max_effect(effect, expr_effect(stmt->while_stmt.cond));
+      effect = max_effect(effect, stmt_effect(stmt->while_stmt.body));
+      break;
+    case STMT_RETURN:
+      effect = max_effect(effect, expr_effect(stmt->ret_stmt.value));
+      break;
+    case STMT_INLINE_ASM:
+    case STMT_PAR:
+      effect = EFFECT_WRITE;
+      break;
+    }
+    
+    stmt = stmt->next;
+  }
+  
+  return effect;
+}
+
+static int count_expr(expr_t *expr, taddr_t taddr, int lo, int hi, int f_addr)
+{
+  int num = 0;
+  
+  while (expr) {
+    switch (expr->texpr) {
+    case EXPR_LOAD:
+    case EXPR_ADDR:
+      num += count_expr(expr->addr.base, taddr, lo, hi, f_addr);
+      
+      expr_t *root = addr_root(expr->addr.base);
+      int f_value = expr->texpr == EXPR_ADDR || (expr->type.dcltr && expr->type.dcltr->type == DCLTR_ARRAY);
+      
+      if ((f_value || !f_addr)
+      && expr->addr.taddr == taddr
+      && root->texpr == EXPR_CONST
+      && root->num >= lo
+      && root->num < hi)
+        num++;
+      break;
+    case EXPR_BINOP:
+      num += count_expr(expr->binop.lhs, taddr, lo, hi, f_addr);
+      num += count_expr(expr->binop.rhs, taddr, lo, hi, f_addr);
+      break;
+    case EXPR_CALL:
+      num += count_expr(expr->post.post, taddr, lo, hi, f_addr);
+      break;
+    case EXPR_ARG:
+      num += count_expr(expr->arg.base, taddr, lo, hi, f_addr);
+      num += count_expr(expr->arg.next, taddr, lo, hi, f_addr);
+      break;
+    case EXPR_CAST:
+      num += count_expr(expr->unary.base, taddr, lo, hi, f_addr);
+      break;
+    default:
+      break;
+    }
+    
+    expr = expr->next;
+  }
+  
+  return num;
+}
+
+static int count_stmt(stmt_t *stmt, taddr_t taddr, int lo, int hi, int f_addr)
+{
+  int num = 0;
+  
+  while (stmt) {
+    switch (stmt->tstmt) {
+    case STMT_EXPR:
+      num += count_expr(stmt->expr, taddr, lo, hi, f_addr);
+      break;
+    case STMT_IF:
+      num += count_expr(stmt->if_stmt.cond, taddr, lo, hi, f_addr);
+      num += count_stmt(stmt->if_stmt.body, taddr, lo, hi, f_addr);
+      num += count_stmt(stmt->if_stmt.next_if, taddr, lo, hi, f_addr);
+      num += count_stmt(stmt->if_stmt.else_body, taddr, lo, hi, f_addr);
+      break;
+    case STMT_WHILE:
+      num += count_expr(stmt->while_stmt.cond, taddr, lo, hi, f_addr);
+      num += count_stmt(stmt->while_stmt.body, taddr, lo, hi, f_addr);
+      break;
+    case STMT_RETURN:
+      num += count_expr(stmt->ret_stmt.value, taddr, lo, hi, f_addr);
+      break;
+    case STMT_PAR:
+      num += count_expr(stmt->par_stmt.var, taddr, lo, hi, f_addr);
+      num += count_expr(stmt->par_stmt.limit, taddr, lo, hi, f_addr);
+      num += count_expr(stmt->par_stmt.reduce, taddr, lo, hi, f_addr);
+      num += count_stmt(stmt->par_stmt.body, taddr, lo, hi, f_addr);
+      break;
+    default:
+      break;
+    }
+    
+    stmt = stmt->next;
+  }
+  
+  return num;
+}
+
+static int count_refs(taddr_t taddr, int lo, int hi, int f_addr)
+{
+  if (taddr == ADDR_LOCAL)
+    return count_stmt(cur_loop->func->body, taddr, lo, hi, f_addr);
+  
+  int num = count_stmt(cur_unit->stmt, taddr, lo, hi, f_addr);
+  
+  for (func_t *func = cur_unit->func; func; func = func->next)
+    num += count_stmt(func->body, taddr, lo, hi, f_addr);
+  
+  return num;
+}
+
+static int is_escaped(decl_t *obj, taddr_t taddr)
+{
+  int size = type_size(obj->type.spec, obj->type.dcltr);
+  return count_refs(taddr, obj->offset, obj->offset + size, 1) > 0;
+}
+
+static int may_alias(access_t *a, access_t *b)
+{
+  if (a->obj && b->obj)
+    return a->obj == b->obj;
+  
+  if (a->obj)
+    return is_escaped(a->obj, a->taddr);
+  
+  if (b->obj)
+    return is_escaped(b->obj, b->taddr);
+  
+  return 1;
+}
+
+static int is_carried(access_t *a, access_t *b)
+{
+  int scale = a->scale;
+  if (scale <= 0)
+    return 1;
+  
+  int lo = b->offset - a->offset - a->size;
+  int hi = b->offset + b->size - a->offset;
+  
+  for (int d = lo / scale - 1; d * scale < hi; d++) {
+    if (d && d * scale > lo)
+      return 1;
+  }
+  
+  return 0;
+}
+
+static int is_conflict(access_t *w, access_t *a)
+{
+  if (!may_alias(w, a))
+    return 0;
+  
+  if (w->f_reduce && a->f_reduce)
+    return 0;
+  
+  int f_same = (w->obj && w->obj == a->obj) || (w->ptr && w->ptr == a->ptr);
+  
+  if (f_same
+  && !w->f_reduce
+  && w->f_index && !w->f_other
+  && a->f_index && !a->f_other
+  && w->scale == a->scale)
+    return is_carried(w, a);
+  
+  return 1;
+}
+
+static void check_accesses(access_t *bound)
+{
+  for (access_t *w = access_list; w; w = w->next) {
+    if (!w->f_write || w->f_private)
+      continue;
+    
+    if (w->f_reduce) {
+      if (cur_loop->reduce && !is_var(w->expr, cur_loop->reduce))
+        reject("sums into both '%s' and '%s'", decl_name(cur_loop->reduce_obj), decl_name(w->obj));
+      cur_loop->reduce = w->expr;
+      cur_loop->reduce_obj = w->obj;
+    } else if (!w->obj && !w->ptr) {
+      reject("writes through a pointer it cannot follow");
+    } else if (!w->f_index && !w->f_other) {
+      reject("assigns to '%s' on every iteration", decl_name(w->obj ? w->obj : w->ptr));
+    } else if (!w->f_index || w->f_other) {
+      reject("writes to '%s' at an index other than '%s'", decl_name(w->obj ? w->obj : w->ptr), decl_name(cur_var_obj));
+    }
+    
+    for (access_t *a = access_list; a; a = a->next) {
+      if (a == w || a->f_private)
+        continue;
+      
+      if (is_conflict(w, a)) {
+        decl_t *lhs = w->obj ? w->obj : w->ptr;
+        decl_t *rhs = a->obj ? a->obj : a->ptr;
+        
+        if (lhs == rhs)
+          reject("'%s' is carried from one iteration to the next", decl_name(lhs));
+        else
+          reject("'%s' and '%s' may overlap", decl_name(lhs), decl_name(rhs));
+      }
+    }
+    
+    for (access_t *a = bound; a; a = a->next) {
+      if (may_alias(w, a))
+        reject("the bound may change inside the loop");
+    }
+    
+    if (read_func)
+      reject("calls '%s', which reads memory the loop writes", hash_get(read_func->name));
+  }
+}
+
+static stmt_t *find_incr(stmt_t *body, expr_t *var, stmt_t **prev)
+{
+  *prev = NULL;
+  
+  if (!body)
+    return NULL;
+  
+  while (body->next) {
+    *prev = body;
+    body = body->next;
+  }
+  
+  expr_t *expr = body->expr;
+  
+  if (body->tstmt != STMT_EXPR
+  || !expr
+  || expr->next
+  || expr->texpr != EXPR_BINOP
+  || expr->binop.op != OPERATOR_ASSIGN
+  || !is_var(expr->binop.lhs, var))
+    return NULL;
+  
+  expr_t *rhs = expr->binop.rhs;
+  
+  if (rhs->texpr != EXPR_BINOP
+  || rhs->binop.op != OPERATOR_ADD
+  || !is_var(rhs->binop.lhs, var)
+  || rhs->binop.rhs->texpr != EXPR_CONST
+  || rhs->binop.rhs->num != 1)
+    return NULL;
+  
+  return body;
+}
+
+static void free_accesses(access_t *access)
+{
+  while (access) {
+    access_t *next = access->next;
+    free(access);
+    access = next;
+  }
+}
+
+static void analyse_loop(loop_t *loop)
+{
+  stmt_t *stmt = loop->stmt;
+  expr_t *cond = stmt->while_stmt.cond;
+  
+  cur_loop = loop;
+  access_list = NULL;
+  read_func = NULL;
+  cond_depth = 0;
+  
+  if (cond->next
+  || cond->texpr != EXPR_BINOP
+  || cond->binop.op != OPERATOR_LSS
+  || !is_par_var(cond->binop.lhs)) {
+    reject("condition is not of the form 'i < n'");
+    return;
+  }
+  
+  expr_t *var = cond->binop.lhs;
+  cur_var = var;
+  cur_var_obj = find_decl(var->addr.taddr, var->addr.base->num);
+  
+  stmt_t *prev;
+  stmt_t *incr = find_incr(stmt->while_stmt.body, var, &prev);
+  
+  if (!incr) {
+    reject("does not end by adding 1 to '%s'", decl_name(cur_var_obj));
+    return;
+  }
+  
+  if (count_expr(cond->binop.rhs, var->addr.taddr, var->addr.base->num, var->addr.base->num + 4, 0))
+    reject("the bound depends on '%s'", decl_name(cur_var_obj));
+  
+  scan_expr(cond->binop.rhs);
+  
+  access_t *bound = access_list;
+  access_list = NULL;
+  
+  if (prev) {
+    prev->next = NULL;
+    scan_stmt(stmt->while_stmt.body);
+    prev->next = incr;
+  }
+  
+  check_accesses(bound);
+  
+  int lo = loop->local_lo;
+  int hi = loop->local_hi;
+  
+  if (hi > lo) {
+    int num_body = count_stmt(stmt->while_stmt.body, loop->taddr, lo, hi, 0);
+    if (count_refs(loop->taddr, lo, hi, 0) > num_body)
+      reject("a variable declared in the loop is used after it");
+  }
+  
+  free_accesses(bound);
+  free_accesses(access_list);
+  
+  if (loop->reason[0])
+    return;
+  
+  loop->f_par = 1;
+  
+  stmt_t *body = stmt->while_stmt.body;
+  
+  if (prev)
+    prev->next = NULL;
+  else
+    body = make_expr_stmt(NULL);
+  
+  stmt->tstmt = STMT_PAR;
+  stmt->par_stmt.var = var;
+  stmt->par_stmt.limit = cond->binop.rhs;
+  stmt->par_stmt.reduce = loop->reduce;
+  stmt->par_stmt.body = body;
+  stmt->par_stmt.taddr = loop->taddr;
+  stmt->par_stmt.local_lo = loop->local_lo;
+  stmt->par_stmt.local_hi = loop->local_hi;
+}
+
+static void walk_stmt(stmt_t *stmt, loop_t *outer)
+{
+  while (stmt) {
+    switch (stmt->tstmt) {
+    case STMT_IF:
+      walk_stmt(stmt->if_stmt.body, outer);
+      walk_stmt(stmt->if_stmt.next_if, outer);
+      walk_stmt(stmt->if_stmt.else_body, outer);
+      break;
+    case STMT_WHILE:
+      if (!stmt->while_stmt.loop) {
+        walk_stmt(stmt->while_stmt.body, outer);
+      } else if (outer) {
+        loop_t *loop = stmt->while_stmt.loop;
+        loop->outer = outer;
+        walk_stmt(stmt->while_stmt.body, outer);
+      } else {
+        loop_t *loop = stmt->while_stmt.loop;
+        stmt_t *body = stmt->while_stmt.body;
+        analyse_loop(loop);
+        walk_stmt(body, loop->f_par ? loop : NULL);
+      }
+      break;
+    default:
+      break;
+    }
+    
+    stmt = stmt->next;
+  }
+}
+
+void autopar(unit_t *unit)
+{
+  if (!f_enabled)
+    return;
+  
+  cur_unit = unit;
+  
+  for (func_t *func = unit->func; func; func = func->next)
+    walk_stmt(func->body, NULL);
+  
+  walk_stmt(unit->stmt, NULL);
+  
+  for (loop_t *loop = loop_body; loop; loop = loop->next) {
+    fprintf(stderr, "%s:%i: ", loop->fname, loop->line);
+    
+    if (loop->f_par && loop->reduce)
+      fprintf(stderr, "parallelized, summing into '%s'\n", decl_name(loop->reduce_obj));
+    else if (loop->f_par)
+      fprintf(stderr, "parallelized\n");
+    else if (loop->outer)
+      fprintf(stderr, "not parallelized: inside the parallel loop at line %i\n", loop->outer->line);
+    else
+      fprintf(stderr, "not parallelized: %s\n", loop->reason);
+  }
+}
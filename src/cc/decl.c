@@ -2,8 +2,30 @@
 
 #define MAX_SPEC_CACHE 16
 
+#include "frag.h"
+#include "pch.h"
+#include "../vm/native.h"
+#include "../vm/instr.h"
 #include <stdlib.h>
 
+typedef struct intrinsic_s intrinsic_t;
+
+struct intrinsic_s {
+  char *name;
+  char *params;
+  int ret;
+  instr_t instr;
+};
+
+static intrinsic_t intrinsic_tbl[] = {
+  { "xchg",   "pi",   1, XCHG   },
+  { "cas",    "pii",  1, CAS    },
+  { "fadd",   "pi",   1, FADD   },
+  { "fence",  "",     0, FENCE  }
+};
+
+static int num_intrinsic_tbl = sizeof(intrinsic_tbl) / sizeof(intrinsic_t);
+
 spec_t *ty_u0;
 spec_t *ty_i8;
 spec_t *ty_i32;
@@ -35,6 +57,35 @@ void decl_init()
   ty_i32 = spec_cache_find(TY_I32, NULL);
   
   current_func = NULL;
+  current_scope = scope_global;
+  
+  intrinsic_init();
+}
+
+void intrinsic_init()
+{
+  for (int i = 0; i < num_intrinsic_tbl; i++) {
+    intrinsic_t *intrinsic = &intrinsic_tbl[i];
+    
+    param_t *params = NULL, *head = NULL;
+    for (char *c = intrinsic->params; *c; c++) {
+      dcltr_t *dcltr = *c == 'p' ? make_dcltr_pointer(NULL) : NULL;
+      param_t *param = make_param(ty_i32, dcltr, NULL);
+      
+      if (head)
+        head = head->next = param;
+      else
+        params = head = param;
+    }
+    
+    type_t type = { intrinsic->ret ? ty_i32 : NULL, NULL };
+    
+    hash_t name = hash_value(intrinsic->name);
+    func_t *func = make_func(name, &type, params, NULL, 0);
+    func->intrinsic = intrinsic->instr;
+    
+    map_put(scope_func, name, func);
+  }
 }
 
 int is_type_match(type_t *lhs, type_t *rhs)
@@ -91,6 +142,7 @@ int type_align(spec_t *spec, dcltr_t *dcltr)
     case TY_I8:
       return 1;
     case TY_I32:
+    case TY_REGION:
       return 4;
     case TY_STRUCT:
       return spec->struct_scope->size;
@@ -120,6 +172,7 @@ int type_size(spec_t *spec, dcltr_t *dcltr)
     case TY_I8:
       return 1;
     case TY_I32:
+    case TY_REGION:
       return 4;
     case TY_STRUCT:
       return spec->struct_scope->size;
@@ -145,8 +198,55 @@ func_t *func_declaration()
   param_t *params = func_params();
   func_type(&type);
   
-  func_t *func = make_func(name, &type, params, NULL, 0);
-  map_put(scope_func, name, func);
+  func_t *func = map_get(scope_func, name);
+  
+  if (!func) {
+    func = make_func(name, &type, params, NULL, 0);
+    map_put(scope_func, name, func);
+  } else if (func->body || func->frag || func->native >= 0 || func->intrinsic >= 0) {
+    token_error("redefinition of %s", hash_get(name));
+  } else if (!is_proto_match(func, &type, params)) {
+    token_error("conflicting types for %s", hash_get(name));
+  }
+  
+  if (lex.token == ';') {
+    pch_note(NOTE_PROTO, name);
+    match(';');
+    
+    map_flush(scope_local->map);
+    scope_local->size = 0;
+    scope_local->decl = NULL;
+    
+    return func;
+  }
+  
+  func->params = params;
+  func->f_header = lex.fid - lex.fstack > 1;
+  pch_note(NOTE_FUNC, name);
+  
+  if (frag_enabled && lex.token == '{') {
+    func->frag_line = lex.fid->line_no;
+    
+    int len;
+    const char *src = lex_skip_block(&len);
+    
+    if (src) {
+      frag_key_t key = frag_key(func, src, len);
+      
+      if ((func->frag = frag_find(key))) {
+        next();
+        
+        map_flush(scope_local->map);
+        scope_local->size = 0;
+        scope_local->decl = NULL;
+        
+        return func;
+      }
+      
+      func->frag_rec = frag_record(key, src, len);
+      lex_unskip();
+    }
+  }
   
   current_func = func;
   current_scope = scope_local;
@@ -160,10 +260,95 @@ func_t *func_declaration()
   
   map_flush(scope_local->map);
   scope_local->size = 0;
+  scope_local->decl = NULL;
   
   return func;
 }
 
+int is_proto_match(func_t *func, type_t *type, param_t *params)
+{
+  if ((func->type.spec != NULL) != (type->spec != NULL))
+    return 0;
+  
+  if (type->spec && !is_type_match(&func->type, type))
+    return 0;
+  
+  param_t *param = func->params;
+  
+  while (param && params) {
+    if (!is_type_match(&param->type, &params->type))
+      return 0;
+    
+    param = param->next;
+    params = params->next;
+  }
+  
+  return !param && !params;
+}
+
+int is_native_param(param_t *param, int c)
+{
+  switch (c) {
+  case 'i':
+    return param->type.spec->tspec == TY_I32 && !param->type.dcltr;
+  case 'p':
+    return param->type.dcltr && param->type.dcltr->type == DCLTR_POINTER;
+  default:
+    return 0;
+  }
+}
+
+int extern_declaration()
+{
+  if (lex.token != TK_EXTERN)
+    return 0;
+  
+  match(TK_EXTERN);
+  match(TK_FN);
+  
+  hash_t name = lex.token_hash;
+  match(TK_IDENTIFIER);
+  
+  type_t type = { 0 };
+  
+  param_t *params = func_params();
+  func_type(&type);
+  
+  map_flush(scope_local->map);
+  scope_local->size = 0;
+  scope_local->decl = NULL;
+  
+  int idx = native_find(hash_get(name));
+  if (idx < 0)
+    token_error("unknown native function '%s'", hash_get(name));
+  
+  native_t *native = &native_tbl[idx];
+  
+  param_t *param = params;
+  for (char *c = native->params; *c; c++) {
+    if (!param || !is_native_param(param, *c))
+      token_error("'%s' does not match native signature", hash_get(name));
+    param = param->next;
+  }
+  
+  if (param)
+    token_error("'%s' does not match native signature", hash_get(name));
+  
+  if (native->ret != (type.spec != NULL) || (type.spec && (type.spec->tspec != TY_I32 || type.dcltr)))
+    token_error("'%s' does not match native return type", hash_get(name));
+  
+  func_t *func = make_func(name, &type, params, NULL, 0);
+  func->native = idx;
+  
+  if (!map_put(scope_func, name, func))
+    token_error("redefinition of %s", hash_get(name));
+  
+  pch_note(NOTE_EXTERN, name);
+  match(';');
+  
+  return 1;
+}
+
 void func_type(type_t *type)
 {
   if (lex.token == ':') {
@@ -222,16 +407,18 @@ int struct_declaration()
   match(TK_IDENTIFIER);
   
   scope_t *struct_scope = make_scope(ADDR_LOCAL);
+  struct_scope->name = name;
   
   match('{');
   while (struct_member_declaration(struct_scope));
   match('}');
   
-  match(';');
-  
   if (!map_put(scope_struct, name, struct_scope))
     token_error("redefinition of %s", hash_get(name));
   
+  pch_note(NOTE_STRUCT, name);
+  match(';');
+  
   return 1;
 }
 
@@ -283,6 +470,9 @@ decl_t *declaration(scope_t *scope)
     }
     
     decl = insert_decl(scope, spec, dcltr, init, name, 0);
+    if (scope == scope_global)
+      pch_note(NOTE_GLOBAL, name);
+    
     if (body)
       head = head->next = decl;
     else
@@ -310,6 +500,9 @@ decl_t *insert_decl(scope_t *scope, spec_t *spec, dcltr_t *dcltr, expr_t *init,
   scope->size = (scope->size + align) & ~align;
   
   decl_t *decl = make_decl(spec, dcltr, init, scope->size);
+  decl->name = name;
+  decl->prev = scope->decl;
+  scope->decl = decl;
   scope->size += type_size(spec, dcltr);
   map_put(scope->map, name, decl);
   
@@ -423,6 +616,9 @@ spec_t *specifiers()
   case TK_I32:
     tspec = TY_I32;
     break;
+  case TK_REGION:
+    tspec = TY_REGION;
+    break;
   case TK_IDENTIFIER:
     tspec = TY_STRUCT;
     if (!(struct_scope = map_get(scope_struct, lex.token_hash)))
@@ -457,9 +653,11 @@ spec_t *spec_cache_find(tspec_t tspec, scope_t *struct_scope)
 scope_t *make_scope(taddr_t taddr)
 {
   scope_t *scope = malloc(sizeof(scope_t));
+  scope->name = 0;
   scope->map = make_map();
   scope->taddr = taddr;
   scope->size = 0;
+  scope->decl = NULL;
   return scope;
 }
 
@@ -488,6 +686,7 @@ decl_t *make_decl(spec_t *spec, dcltr_t *dcltr, expr_t *init, int offset)
   decl->offset = offset;
   decl->init = init;
   decl->next = NULL;
+  decl->prev = NULL;
   return decl;
 }
 
@@ -510,6 +709,12 @@ func_t *make_func(hash_t name, type_t *type, param_t *params, stmt_t *body, int
   func->params = params;
   func->body = body;
   func->local_size = local_size;
+  func->native = -1;
+  func->intrinsic = -1;
+  func->frag = NULL;
+  func->frag_rec = NULL;
+  func->frag_line = 0;
+  func->f_header = 0;
   func->next = NULL;
   return func;
 }
@@ -286,6 +286,13 @@ expr_t *postfix()
     }
   }
   
+  if (is_func(expr)) {
+    if (expr->func.func->native >= 0 || expr->func.func->intrinsic >= 0)
+      token_error("cannot take the address of an extern or builtin function");
+    
+    expr->type.spec = ty_i32;
+  }
+  
   return expr;
 }
 
@@ -388,6 +395,9 @@ expr_t *binop(int level)
       if (!is_lvalue(lhs))
         token_error("cannot assign non-lvalue");
       
+      if (is_par_counter(lhs))
+        token_error("cannot change the counter of a par while in its body");
+      
       if (!is_type_match(&lhs->type, &rhs->type))
         token_error("type mismatch");
       
@@ -0,0 +1,416 @@
+#include "frag.h"
+
+#include "p_local.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_BASIS 14695981039346656037ul
+#define FNV_PRIME 1099511628211ul
+
+#define FRAG_MAX (1 << 24)
+#define FRAG_WORD 64
+
+int frag_enabled = 0;
+
+static frag_t *frag_tbl[FRAG_TBL];
+
+void frag_init()
+{
+  frag_enabled = 1;
+  memset(frag_tbl, 0, sizeof(frag_tbl));
+}
+
+static frag_key_t hash_bytes(frag_key_t key, const void *buf, long len)
+{
+  for (long i = 0; i < len; i++) {
+    key ^= ((unsigned char*) buf)[i];
+    key *= FNV_PRIME;
+  }
+  
+  return key;
+}
+
+static frag_key_t hash_int(frag_key_t key, int i)
+{
+  return hash_bytes(key, &i, sizeof(i));
+}
+
+static frag_key_t hash_str(frag_key_t key, hash_t str)
+{
+  char *s = hash_get(str);
+  return hash_bytes(key, s, strlen(s) + 1);
+}
+
+static frag_key_t hash_scope(frag_key_t key, scope_t *scope);
+
+static frag_key_t hash_type(frag_key_t key, type_t *type)
+{
+  if (!type->spec)
+    return hash_int(key, -1);
+  
+  key = hash_int(key, type->spec->tspec);
+  
+  for (dcltr_t *dcltr = type->dcltr; dcltr; dcltr = dcltr->next) {
+    key = hash_int(key, dcltr->type);
+    key = hash_int(key, dcltr->type == DCLTR_ARRAY ? dcltr->size : 0);
+  }
+  
+  if (type->spec->tspec == TY_STRUCT)
+    key = hash_scope(key, type->spec->struct_scope);
+  
+  return key;
+}
+
+static frag_key_t hash_scope(frag_key_t key, scope_t *scope)
+{
+  key = hash_int(key, scope->size);
+  
+  for (decl_t *decl = scope->decl; decl; decl = decl->prev) {
+    key = hash_str(key, decl->name);
+    key = hash_int(key, decl->offset);
+    key = hash_type(key, &decl->type);
+  }
+  
+  return key;
+}
+
+static frag_key_t hash_func(frag_key_t key, func_t *func)
+{
+  key = hash_int(key, func->native);
+  key = hash_int(key, func->intrinsic);
+  key = hash_type(key, &func->type);
+  
+  for (param_t *param = func->params; param; param = param->next) {
+    key = hash_type(key, &param->type);
+    key = hash_int(key, param->addr ? param->addr->addr.base->num : -1);
+  }
+  
+  return key;
+}
+
+frag_key_t frag_hash_ident(frag_key_t key, hash_t name)
+{
+  decl_t *decl;
+  func_t *func;
+  scope_t *scope;
+  
+  key = hash_str(key, name);
+  
+  if ((decl = map_get(scope_global->map, name))) {
+    key = hash_int(key, decl->offset);
+    key = hash_type(key, &decl->type);
+  }
+  
+  if ((func = map_get(scope_func, name)))
+    key = hash_func(key, func);
+  
+  if ((scope = map_get(scope_struct, name)))
+    key = hash_scope(key, scope);
+  
+  return key;
+}
+
+frag_key_t frag_key(func_t *func, const char *src, int len)
+{
+  frag_key_t key = FNV_BASIS;
+  
+  key = hash_bytes(key, lex.fid->fname, strlen(lex.fid->fname) + 1);
+  key = hash_str(key, func->name);
+  key = hash_func(key, func);
+  key = hash_bytes(key, src, len);
+  
+  return key ? key : 1;
+}
+
+static int is_dep_match(frag_t *frag)
+{
+  for (int i = 0; i < frag->num_dep; i++) {
+    if (frag_hash_ident(FNV_BASIS, frag->dep[i].name) != frag->dep[i].key)
+      return 0;
+  }
+  
+  return 1;
+}
+
+frag_t *frag_find(frag_key_t key)
+{
+  for (frag_t *frag = frag_tbl[key % FRAG_TBL]; frag; frag = frag->next) {
+    if (frag->key == key && is_dep_match(frag)) {
+      frag->f_used = 1;
+      return frag;
+    }
+  }
+  
+  return NULL;
+}
+
+static void add_dep(frag_t *frag, hash_t name)
+{
+  for (int i = 0; i < frag->num_dep; i++) {
+    if (frag->dep[i].name == name)
+      return;
+  }
+  
+  frag->dep = realloc(frag->dep, (frag->num_dep + 1) * sizeof(frag_dep_t));
+  frag->dep[frag->num_dep].name = name;
+  frag->dep[frag->num_dep].key = frag_hash_ident(FNV_BASIS, name);
+  frag->num_dep++;
+}
+
+static int is_word(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+frag_t *frag_record(frag_key_t key, const char *src, int len)
+{
+  frag_t *frag = make_frag(key);
+  char word[FRAG_WORD];
+  
+  int i = 0;
+  while (i < len) {
+    if (!is_word(src[i])) {
+      i++;
+      continue;
+    }
+    
+    while (i < len && src[i] >= '0' && src[i] <= '9')
+      i++;
+    
+    int start = i;
+    while (i < len && is_word(src[i]))
+      i++;
+    
+    if (i == start || i - start >= FRAG_WORD)
+      continue;
+    
+    memcpy(word, &src[start], i - start);
+    word[i - start] = '\0';
+    
+    if (strcmp(word, "par") == 0) {
+      free(frag->dep);
+      free(frag->ref);
+      free(frag);
+      return NULL;
+    }
+    
+    add_dep(frag, hash_value(word));
+  }
+  
+  return frag;
+}
+
+void frag_add(frag_t *frag)
+{
+  frag->next = frag_tbl[frag->key % FRAG_TBL];
+  frag_tbl[frag->key % FRAG_TBL] = frag;
+}
+
+func_t *frag_callee(hash_t name)
+{
+  return map_get(scope_func, name);
+}
+
+int frag_get_int(FILE *in, int *i)
+{
+  return fread(i, sizeof(int), 1, in) == 1 && *i >= 0 && *i < FRAG_MAX;
+}
+
+int frag_get_str(FILE *in, hash_t *str)
+{
+  int len;
+  if (!frag_get_int(in, &len) || len == 0)
+    return 0;
+  
+  char *buf = malloc(len);
+  
+  int ok = fread(buf, 1, len, in) == (size_t) len && buf[len - 1] == '\0';
+  if (ok)
+    *str = hash_value(buf);
+  
+  free(buf);
+  
+  return ok;
+}
+
+void frag_put_int(FILE *out, int i)
+{
+  fwrite(&i, sizeof(int), 1, out);
+}
+
+void frag_put_str(FILE *out, hash_t str)
+{
+  char *s = hash_get(str);
+  frag_put_int(out, strlen(s) + 1);
+  fwrite(s, 1, strlen(s) + 1, out);
+}
+
+frag_t *frag_load(FILE *in)
+{
+  frag_key_t key;
+  if (fread(&key, sizeof(key), 1, in) != 1)
+    return NULL;
+  
+  frag_t *frag = make_frag(key);
+  
+  if (!frag_get_int(in, &frag->num_dep))
+    return NULL;
+  
+  frag->dep = malloc((frag->num_dep + 1) * sizeof(frag_dep_t));
+  
+  for (int i = 0; i < frag->num_dep; i++) {
+    if (!frag_get_str(in, &frag->dep[i].name) || fread(&frag->dep[i].key, sizeof(frag_key_t), 1, in) != 1)
+      return NULL;
+  }
+  
+  int code_size;
+  if (!frag_get_int(in, &code_size) || !frag_get_int(in, &frag->num_ref) || !frag_get_int(in, &frag->num_line))
+    return NULL;
+  
+  unsigned char *code = malloc(code_size + 1);
+  
+  if (fread(code, 1, code_size, in) == (size_t) code_size)
+    frag->instr = bin_decode_code(code, code_size, &frag->num_instr);
+  
+  free(code);
+  
+  if (!frag->instr)
+    return NULL;
+  
+  frag->ref = realloc(frag->ref, (frag->num_ref + 1) * sizeof(reloc_t));
+  frag->line = malloc((frag->num_line + 1) * sizeof(line_t));
+  
+  for (int i = 0; i < frag->num_ref; i++) {
+    reloc_t *ref = &frag->ref[i];
+    int type;
+    
+    if (!frag_get_int(in, &type) || !frag_get_int(in, &ref->pos) || ref->pos >= frag->num_instr)
+      return NULL;
+    
+    ref->type = type;
+    ref->name = 0;
+    
+    switch (ref->type) {
+    case RELOC_CODE:
+      if ((int) frag->instr[ref->pos] < 0 || (int) frag->instr[ref->pos] >= frag->num_instr)
+        return NULL;
+      break;
+    case RELOC_SYM:
+    case RELOC_DATA:
+      if (!frag_get_str(in, &ref->name))
+        return NULL;
+      break;
+    default:
+      return NULL;
+    }
+  }
+  
+  hash_t file;
+  if (frag->num_line > 0 && !frag_get_str(in, &file))
+    return NULL;
+  
+  for (int i = 0; i < frag->num_line; i++) {
+    line_t *line = &frag->line[i];
+    line->file = file;
+    
+    if (!frag_get_int(in, &line->pos) || fread(&line->line, sizeof(int), 1, in) != 1)
+      return NULL;
+  }
+  
+  return frag;
+}
+
+int frag_read(FILE *in)
+{
+  int num_frag;
+  if (!frag_get_int(in, &num_frag))
+    return 0;
+  
+  for (int i = 0; i < num_frag; i++) {
+    frag_t *frag = frag_load(in);
+    if (!frag) {
+      memset(frag_tbl, 0, sizeof(frag_tbl));
+      return 0;
+    }
+    
+    frag_add(frag);
+  }
+  
+  return 1;
+}
+
+void frag_save(FILE *out, frag_t *frag)
+{
+  fwrite(&frag->key, sizeof(frag->key), 1, out);
+  frag_put_int(out, frag->num_dep);
+  
+  for (int i = 0; i < frag->num_dep; i++) {
+    frag_put_str(out, frag->dep[i].name);
+    fwrite(&frag->dep[i].key, sizeof(frag_key_t), 1, out);
+  }
+  
+  int code_size;
+  unsigned char *code = bin_encode_code(frag->instr, frag->num_instr, &code_size);
+  
+  frag_put_int(out, code_size);
+  frag_put_int(out, frag->num_ref);
+  frag_put_int(out, frag->num_line);
+  fwrite(code, 1, code_size, out);
+  
+  free(code);
+  
+  for (int i = 0; i < frag->num_ref; i++) {
+    frag_put_int(out, frag->ref[i].type);
+    frag_put_int(out, frag->ref[i].pos);
+    
+    if (frag->ref[i].type != RELOC_CODE)
+      frag_put_str(out, frag->ref[i].name);
+  }
+  
+  if (frag->num_line > 0)
+    frag_put_str(out, frag->line[0].file);
+  
+  for (int i = 0; i < frag->num_line; i++) {
+    frag_put_int(out, frag->line[i].pos);
+    frag_put_int(out, frag->line[i].line);
+  }
+}
+
+void frag_write(FILE *out)
+{
+  int num_frag = 0;
+  
+  for (int i = 0; i < FRAG_TBL; i++) {
+    for (frag_t *frag = frag_tbl[i]; frag; frag = frag->next)
+      num_frag += frag->f_used;
+  }
+  
+  frag_put_int(out, num_frag);
+  
+  for (int i = 0; i < FRAG_TBL; i++) {
+    for (frag_t *frag = frag_tbl[i]; frag; frag = frag->next) {
+      if (!frag->f_used)
+        continue;
+      
+      frag_save(out, frag);
+    }
+  }
+}
+
+frag_t *make_frag(frag_key_t key)
+{
+  frag_t *frag = malloc(sizeof(frag_t));
+  frag->key = key;
+  frag->dep = NULL;
+  frag->num_dep = 0;
+  frag->instr = NULL;
+  frag->num_instr = 0;
+  frag->max_ref = 16;
+  frag->num_ref = 0;
+  frag->ref = malloc(frag->max_ref * sizeof(reloc_t));
+  frag->line = NULL;
+  frag->num_line = 0;
+  frag->f_used = 0;
+  frag->next = NULL;
+  return frag;
+}
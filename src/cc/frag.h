@@ -0,0 +1,54 @@
+#ifndef FRAG_H
+#define FRAG_H
+
+#include "parse.h"
+#include "lex.h"
+#include "../vm/bin.h"
+#include <stdio.h>
+
+#define FRAG_TBL 4096
+
+typedef unsigned long frag_key_t;
+typedef struct frag_dep_s frag_dep_t;
+
+struct frag_dep_s {
+  hash_t name;
+  frag_key_t key;
+};
+
+struct frag_s {
+  frag_key_t key;
+  frag_dep_t *dep;
+  int num_dep;
+  instr_t *instr;
+  int num_instr;
+  reloc_t *ref;
+  int num_ref;
+  int max_ref;
+  line_t *line;
+  int num_line;
+  int f_used;
+  frag_t *next;
+};
+
+extern int frag_enabled;
+
+void frag_init();
+frag_key_t frag_key(func_t *func, const char *src, int len);
+frag_key_t frag_hash_ident(frag_key_t key, hash_t name);
+frag_t *frag_find(frag_key_t key);
+frag_t *frag_record(frag_key_t key, const char *src, int len);
+void frag_add(frag_t *frag);
+func_t *frag_callee(hash_t name);
+int frag_read(FILE *in);
+void frag_write(FILE *out);
+frag_t *frag_load(FILE *in);
+void frag_save(FILE *out, frag_t *frag);
+int frag_get_int(FILE *in, int *i);
+int frag_get_str(FILE *in, hash_t *str);
+void frag_put_int(FILE *out, int i);
+void frag_put_str(FILE *out, hash_t str);
+
+frag_t *make_frag(frag_key_t key);
+
+#endif
@@ -1,5 +1,6 @@
 #include "gen.h"
 
+#include "frag.h"
 #include "../common/hash.h"
 #include "../common/map.h"
 #include "../common/error.h"
@@ -11,6 +12,8 @@
 typedef struct data_s data_t;
 typedef struct label_s label_t;
 typedef struct replace_s replace_t;
+typedef struct par_func_s par_func_t;
+typedef struct block_s block_t;
 
 struct data_s {
   int pos;
@@ -29,6 +32,32 @@ struct replace_s {
   replace_t *next;
 };
 
+struct par_func_s {
+  hash_t lbl;
+  hash_t name;
+  stmt_t *stmt;
+  par_func_t *next;
+};
+
+struct block_s {
+  hash_t name;
+  int start;
+  int end;
+  int shift;
+  int f_live;
+  hash_t *ref;
+  int num_ref;
+  int max_ref;
+};
+
+enum {
+  PAR_I = 0,
+  PAR_HI = 4,
+  PAR_BP = 8,
+  PAR_SUM = 12,
+  PAR_FRAME = 16
+};
+
 static map_t map_data;
 static data_t *data_list, *data_head;
 static int data_size;
@@ -39,19 +68,146 @@ static int num_instr, max_instr;
 static int num_lbl;
 
 static int func_active;
+static hash_t func_name;
 static hash_t ret_lbl;
 
+static sym_t *sym_buf;
+static int num_sym, max_sym;
+
+static line_t *line_buf;
+static int num_line, max_line;
+
+static int gen_object;
+
+static sym_t *export_buf;
+static int num_export, max_export;
+
+static reloc_t *reloc_buf;
+static int num_reloc, max_reloc;
+
+static frag_t *frag_rec;
+static int frag_start;
+
 static map_t map_replace;
-static label_t *label_list;
+static map_t map_label;
+static label_t *label_list, *label_head;
+
+static par_func_t *par_list;
+static stmt_t *par_active;
+
+static map_t map_block;
+static block_t **block_buf;
+static int num_block, max_block;
+
+static int *jump_buf;
+static int num_jump, max_jump;
+
+static int gen_removed = -1;
+
+static void add_sym(sym_t **buf, int *num, int *max, hash_t name)
+{
+  if (*num >= *max) {
+    *max *= 2;
+    *buf = realloc(*buf, *max * sizeof(sym_t));
+  }
+  
+  (*buf)[*num].name = name;
+  (*buf)[*num].pos = num_instr;
+  (*num)++;
+}
+
+void emit_sym(hash_t name)
+{
+  add_sym(&sym_buf, &num_sym, &max_sym, name);
+}
+
+void emit_export(hash_t name)
+{
+  if (gen_object)
+    add_sym(&export_buf, &num_export, &max_export, name);
+}
+
+void emit_reloc(treloc_t type, int pos, hash_t name)
+{
+  if (!gen_object)
+    return;
+  
+  if (num_reloc >= max_reloc) {
+    max_reloc *= 2;
+    reloc_buf = realloc(reloc_buf, max_reloc * sizeof(reloc_t));
+  }
+  
+  reloc_buf[num_reloc].type = type;
+  reloc_buf[num_reloc].pos = pos;
+  reloc_buf[num_reloc].name = name;
+  num_reloc++;
+}
+
+static void add_line(hash_t file, int line, int pos)
+{
+  if (num_line >= max_line) {
+    max_line *= 2;
+    line_buf = realloc(line_buf, max_line * sizeof(line_t));
+  }
+  
+  line_buf[num_line].file = file;
+  line_buf[num_line].line = line;
+  line_buf[num_line].pos = pos;
+  num_line++;
+}
+
+void emit_line(stmt_t *stmt)
+{
+  if (!stmt->line)
+    return;
+  
+  line_t *last = num_line ? &line_buf[num_line - 1] : NULL;
+  
+  if (last && last->file == stmt->file && last->line == stmt->line)
+    return;
+  
+  if (last && last->pos == num_instr) {
+    last->file = stmt->file;
+    last->line = stmt->line;
+    return;
+  }
+  
+  add_line(stmt->file, stmt->line, num_instr);
+}
+
+void frag_ref(treloc_t type, int pos, hash_t name)
+{
+  if (!frag_rec)
+    return;
+  
+  if (frag_rec->num_ref >= frag_rec->max_ref) {
+    frag_rec->max_ref *= 2;
+    frag_rec->ref = realloc(frag_rec->ref, frag_rec->max_ref * sizeof(reloc_t));
+  }
+  
+  frag_rec->ref[frag_rec->num_ref].type = type;
+  frag_rec->ref[frag_rec->num_ref].pos = pos;
+  frag_rec->ref[frag_rec->num_ref].name = name;
+  frag_rec->num_ref++;
+}
 
 int emit(instr_t instr);
 void emit_jmp_hash(hash_t lbl);
 void emit_label(instr_t instr, hash_t lbl);
 void emit_frame_enter(int size);
 void emit_frame_leave();
+void emit_sym(hash_t name);
+void emit_export(hash_t name);
+void emit_reloc(treloc_t type, int pos, hash_t name);
+void emit_line(stmt_t *stmt);
+void frag_ref(treloc_t type, int pos, hash_t name);
 data_t *emit_data_str(hash_t str_hash);
+data_t *find_data_str(hash_t str_hash);
 
 void gen_func(func_t *func);
+void gen_frag(func_t *func);
+void frag_begin(func_t *func);
+void frag_end(func_t *func);
 void gen_param(param_t *param);
 
 void gen_stmt(stmt_t *stmt);
@@ -60,11 +216,20 @@ void gen_while(stmt_t *stmt);
 void gen_ret(stmt_t *stmt);
 void gen_asm(stmt_t *stmt);
 void gen_decl(stmt_t *stmt);
+void gen_par(stmt_t *stmt);
+void gen_par_func(par_func_t *par);
+int gen_par_addr(expr_t *expr);
+void gen_par_shared_addr(expr_t *expr);
+void gen_global_addr(expr_t *base);
 
 void gen_expr(expr_t *expr);
+void gen_expr_node(expr_t *expr);
+void gen_expr_stmt(expr_t *expr);
+int has_value(expr_t *expr);
 void gen_const(expr_t *expr);
 void gen_addr(expr_t *expr);
 void gen_call(expr_t *expr);
+void gen_func_addr(expr_t *expr);
 void gen_load(expr_t *expr);
 void gen_cast(expr_t *expr);
 void gen_str(expr_t *expr);
@@ -81,37 +246,114 @@ replace_t *make_replace(int pos);
 hash_t tmp_label();
 void set_label(hash_t name);
 void set_replace(hash_t name, int pos);
+void set_func_replace(func_t *func, int pos);
 void replace_all();
+void begin_block(hash_t name);
+void block_ref(hash_t name);
+void remove_dead();
+void add_jump(int pos);
+int peephole();
 tspec_t simplify_type_spec(type_t *type);
 int sub_str_match_lhs(char *lhs, char *rhs);
 void *collapse_data(int *data_len);
 
-bin_t *gen(unit_t *unit)
+bin_t *gen(unit_t *unit, int f_object)
 {
   max_instr = 1024;
   num_lbl = 0;
   num_instr = 0;
-  bss_size = unit->scope.size;
+  data_size = 0;
+  bss_size = (unit->scope.size + 3) & (~3);
+  gen_object = f_object;
   
   instr_buf = malloc(max_instr * sizeof(instr_t));
   data_list = NULL;
   data_head = NULL;
+  label_list = NULL;
+  label_head = NULL;
+  par_list = NULL;
+  par_active = NULL;
+  
+  max_sym = 64;
+  num_sym = 0;
+  sym_buf = malloc(max_sym * sizeof(sym_t));
+  
+  max_line = 256;
+  num_line = 0;
+  line_buf = malloc(max_line * sizeof(line_t));
+  
+  max_export = 64;
+  num_export = 0;
+  export_buf = malloc(max_export * sizeof(sym_t));
+  
+  max_reloc = 256;
+  num_reloc = 0;
+  reloc_buf = malloc(max_reloc * sizeof(reloc_t));
+  
+  max_block = 64;
+  num_block = 0;
+  block_buf = malloc(max_block * sizeof(block_t*));
+  
+  max_jump = 256;
+  num_jump = 0;
+  jump_buf = malloc(max_jump * sizeof(int));
   
   map_replace = make_map();
+  map_label = make_map();
   map_data = make_map();
+  map_block = make_map();
   
-  gen_stmt(unit->stmt);
-  emit(INT);
-  emit(SYS_EXIT);
+  begin_block(0);
+  
+  if (gen_object) {
+    func_name = hash_value("_init");
+    emit_sym(func_name);
+    
+    emit_frame_enter(0);
+    gen_stmt(unit->stmt);
+    emit_frame_leave();
+  } else {
+    func_name = hash_value("_start");
+    emit_sym(func_name);
+    
+    gen_stmt(unit->stmt);
+    emit(INT);
+    emit(SYS_EXIT);
+  }
   
   gen_func(unit->func);
   
+  for (par_func_t *par = par_list; par; par = par->next)
+    gen_par_func(par);
+  
+  remove_dead();
+  
   replace_all();
   
+  gen_removed = peephole();
+  free(jump_buf);
+  
   int data_size;
   void *data = collapse_data(&data_size);
   
-  return make_bin(instr_buf, num_instr, data, data_size, (bss_size + 3) & (~3));
+  bin_t *bin = make_bin(instr_buf, num_instr, data, data_size, bss_size);
+  bin->sym = sym_buf;
+  bin->num_sym = num_sym;
+  bin->line = line_buf;
+  bin->num_line = num_line;
+  
+  if (gen_object) {
+    bin->f_object = 1;
+    bin->export = export_buf;
+    bin->num_export = num_export;
+    bin->reloc = reloc_buf;
+    bin->num_reloc = num_reloc;
+  } else {
+    free(export_buf);
+    free(reloc_buf);
+  }
+  
+  return bin;
 }
 
 void gen_func(func_t *func)
@@ -120,8 +362,23 @@ void gen_func(func_t *func)
   
   while (func) {
     ret_lbl = tmp_label();
+    func_name = func->name;
     
+    begin_block(func->name);
     set_label(func->name);
+    emit_sym(func->name);
+    
+    if (!func->f_header)
+      emit_export(func->name);
+    
+    if (func->frag) {
+      gen_frag(func);
+      func = func->next;
+      continue;
+    }
+    
+    if (func->frag_rec)
+      frag_begin(func);
     
     emit_frame_enter(func->local_size);
     
@@ -131,12 +388,99 @@ void gen_func(func_t *func)
     set_label(ret_lbl);
     emit_frame_leave();
     
+    if (frag_rec)
+      frag_end(func);
+    
     func = func->next;
   }
   
   func_active = 0;
 }
 
+void frag_begin(func_t *func)
+{
+  frag_rec = func->frag_rec;
+  frag_start = num_instr;
+}
+
+void frag_end(func_t *func)
+{
+  frag_t *frag = frag_rec;
+  frag_rec = NULL;
+  
+  frag->num_instr = num_instr - frag_start;
+  frag->instr = malloc((frag->num_instr + 1) * sizeof(instr_t));
+  memcpy(frag->instr, &instr_buf[frag_start], frag->num_instr * sizeof(instr_t));
+  
+  for (int i = 0; i < frag->num_ref; i++) {
+    reloc_t *ref = &frag->ref[i];
+    ref->pos -= frag_start;
+    
+    if (ref->type == RELOC_CODE) {
+      label_t *label = map_get(map_label, ref->name);
+      frag->instr[ref->pos] = label->pos - frag_start;
+      ref->name = 0;
+    }
+  }
+  
+  int first = num_line;
+  while (first > 0 && line_buf[first - 1].pos >= frag_start)
+    first--;
+  
+  frag->num_line = num_line - first;
+  frag->line = malloc((frag->num_line + 1) * sizeof(line_t));
+  
+  for (int i = 0; i < frag->num_line; i++) {
+    frag->line[i] = line_buf[first + i];
+    frag->line[i].pos -= frag_start;
+    frag->line[i].line -= func->frag_line;
+    
+    if (frag->line[i].file != frag->line[0].file) {
+      func->frag_rec = NULL;
+      return;
+    }
+  }
+  
+  frag->f_used = 1;
+  frag_add(frag);
+}
+
+void gen_frag(func_t *func)
+{
+  frag_t *frag = func->frag;
+  int start = num_instr;
+  
+  for (int i = 0; i < frag->num_instr; i++)
+    emit(frag->instr[i]);
+  
+  for (int i = 0; i < frag->num_ref; i++) {
+    reloc_t *ref = &frag->ref[i];
+    int pos = start + ref->pos;
+    func_t *callee;
+    
+    switch (ref->type) {
+    case RELOC_CODE:
+      instr_buf[pos] += start;
+      add_jump(pos);
+      break;
+    case RELOC_SYM:
+      if (!(callee = frag_callee(ref->name)))
+        error("undefined function '%s'", hash_get(ref->name));
+      
+      set_func_replace(callee, pos);
+      break;
+    case RELOC_DATA:
+      instr_buf[pos] = find_data_str(ref->name)->pos;
+      break;
+    default:
+      break;
+    }
+  }
+  
+  for (int i = 0; i < frag->num_line; i++)
+    add_line(frag->line[i].file, frag->line[i].line + func->frag_line, frag->line[i].pos + start);
+}
+
 void gen_param(param_t *param)
 {
   if (!param)
@@ -152,9 +496,11 @@ void gen_param(param_t *param)
 void gen_stmt(stmt_t *stmt)
 {
   while (stmt) {
+    emit_line(stmt);
+    
     switch (stmt->tstmt) {
     case STMT_EXPR:
-      gen_expr(stmt->expr);
+      gen_expr_stmt(stmt->expr);
       break;
     case STMT_IF:
       gen_if(stmt);
@@ -168,6 +514,9 @@ void gen_stmt(stmt_t *stmt)
     case STMT_INLINE_ASM:
       gen_asm(stmt);
       break;
+    case STMT_PAR:
+      gen_par(stmt);
+      break;
     default:
       error("unknown case");
       break;
@@ -270,54 +619,266 @@ void gen_while(stmt_t *stmt)
   set_label(end_lbl);
 }
 
-void gen_expr(expr_t *expr)
+void gen_par(stmt_t *stmt)
 {
-  if (!expr)
-    return;
+  frag_rec = NULL;
+  
+  par_func_t *par = malloc(sizeof(par_func_t));
+  par->lbl = tmp_label();
+  par->name = func_name;
+  par->stmt = stmt;
+  par->next = par_list;
+  par_list = par;
+  
+  emit(PUSH);
+  set_replace(par->lbl, emit(0));
+  block_ref(par->lbl);
+  
+  gen_expr(stmt->par_stmt.var);
+  gen_expr(stmt->par_stmt.limit);
+  emit(LBP);
+  
+  emit(INT);
+  emit(SYS_PARFOR);
+  
+  gen_addr(stmt->par_stmt.var);
+  emit(STR);
+}
+
+void gen_par_func(par_func_t *par)
+{
+  stmt_t *stmt = par->stmt;
+  
+  hash_t cond_lbl = tmp_label();
+  hash_t end_lbl = tmp_label();
+  
+  int local_size = stmt->par_stmt.local_hi - stmt->par_stmt.local_lo;
+  
+  char name[256];
+  snprintf(name, sizeof(name), "%s.par", hash_get(par->name));
+  
+  begin_block(par->lbl);
+  set_label(par->lbl);
+  emit_sym(hash_value(name));
+  emit_frame_enter(PAR_FRAME + ((local_size + 3) & ~3));
+  
+  emit(LBP);
+  emit(STR);
+  
+  emit(LBP);
+  emit(PUSH);
+  emit(PAR_HI);
+  emit(ADD);
+  emit(STR);
   
+  emit(LBP);
+  emit(PUSH);
+  emit(PAR_BP);
+  emit(ADD);
+  emit(STR);
+  
+  emit(PUSH);
+  emit(0);
+  emit(LBP);
+  emit(PUSH);
+  emit(PAR_SUM);
+  emit(ADD);
+  emit(STR);
+  
+  set_label(cond_lbl);
+  emit(LBP);
+  emit(LDR);
+  emit(LBP);
+  emit(PUSH);
+  emit(PAR_HI);
+  emit(ADD);
+  emit(LDR);
+  emit(CMP);
+  emit_label(JGE, end_lbl);
+  
+  par_active = stmt;
+  gen_stmt(stmt->par_stmt.body);
+  par_active = NULL;
+  
+  emit(LBP);
+  emit(LDR);
+  emit(PUSH);
+  emit(1);
+  emit(ADD);
+  emit(LBP);
+  emit(STR);
+  
+  emit_label(JMP, cond_lbl);
+  set_label(end_lbl);
+  
+  if (stmt->par_stmt.reduce) {
+    gen_par_shared_addr(stmt->par_stmt.reduce);
+    emit(LBP);
+    emit(PUSH);
+    emit(PAR_SUM);
+    emit(ADD);
+    emit(LDR);
+    emit(FADD);
+    emit(POP);
+  }
+  
+  emit_frame_leave();
+}
+
+static int addr_root(expr_t *base)
+{
+  while (base->texpr == EXPR_BINOP && base->binop.op == OPERATOR_ADD)
+    base = base->binop.lhs;
+  
+  return base->texpr == EXPR_CONST ? base->num : -1;
+}
+
+static int is_same_var(expr_t *expr, expr_t *var)
+{
+  return var
+  && expr->addr.taddr == var->addr.taddr
+  && expr->addr.base->texpr == EXPR_CONST
+  && expr->addr.base->num == var->addr.base->num;
+}
+
+int gen_par_addr(expr_t *expr)
+{
+  stmt_t *stmt = par_active;
+  
+  if (is_same_var(expr, stmt->par_stmt.var)) {
+    emit(LBP);
+    return 1;
+  }
+  
+  if (is_same_var(expr, stmt->par_stmt.reduce)) {
+    emit(LBP);
+    emit(PUSH);
+    emit(PAR_SUM);
+    emit(ADD);
+    return 1;
+  }
+  
+  int root = addr_root(expr->addr.base);
+  
+  if (expr->addr.taddr == stmt->par_stmt.taddr
+  && root >= stmt->par_stmt.local_lo
+  && root < stmt->par_stmt.local_hi) {
+    emit(LBP);
+    emit(PUSH);
+    emit(PAR_FRAME - stmt->par_stmt.local_lo);
+    emit(ADD);
+    gen_expr(expr->addr.base);
+    emit(ADD);
+    return 1;
+  }
+  
+  if (expr->addr.taddr == ADDR_LOCAL) {
+    gen_par_shared_addr(expr);
+    return 1;
+  }
+  
+  return 0;
+}
+
+void gen_par_shared_addr(expr_t *expr)
+{
+  if (expr->addr.taddr == ADDR_LOCAL) {
+    emit(LBP);
+    emit(PUSH);
+    emit(PAR_BP);
+    emit(ADD);
+    emit(LDR);
+    gen_expr(expr->addr.base);
+    emit(ADD);
+  } else {
+    gen_global_addr(expr->addr.base);
+  }
+}
+
+void gen_global_addr(expr_t *base)
+{
+  int pos = num_instr;
+  
+  gen_expr(base);
+  
+  if (addr_root(base) >= 0)
+    emit_reloc(RELOC_BSS, pos + 1, 0);
+}
+
+void gen_expr(expr_t *expr)
+{
   while (expr) {
-    switch (expr->texpr) {
-    case EXPR_CONST:
-      gen_const(expr);
-      break;
-    case EXPR_ADDR:
-      gen_addr(expr);
-      break;
-    case EXPR_LOAD:
-      gen_load(expr);
-      break;
-    case EXPR_BINOP:
-      gen_binop(expr);
-      break;
-    case EXPR_CALL:
-      gen_call(expr);
-      break;
-    case EXPR_CAST:
-      gen_cast(expr);
-      break;
-    case EXPR_STR:
-      gen_str(expr);
-      break;
-    default:
-      error("unknown case");
-      break;
-    }
+    gen_expr_node(expr);
+    expr = expr->next;
+  }
+}
+
+void gen_expr_stmt(expr_t *expr)
+{
+  while (expr) {
+    gen_expr_node(expr);
+    
+    if (has_value(expr))
+      emit(POP);
     
     expr = expr->next;
   }
 }
 
-void gen_str(expr_t *expr)
+void gen_expr_node(expr_t *expr)
 {
-  data_t *data = map_get(map_data, expr->str_hash);
-  
-  if (!data) {
-    data = emit_data_str(expr->str_hash);
-    map_put(map_data, expr->str_hash, data);
+  switch (expr->texpr) {
+  case EXPR_CONST:
+    gen_const(expr);
+    break;
+  case EXPR_ADDR:
+    gen_addr(expr);
+    break;
+  case EXPR_LOAD:
+    gen_load(expr);
+    break;
+  case EXPR_BINOP:
+    gen_binop(expr);
+    break;
+  case EXPR_CALL:
+    gen_call(expr);
+    break;
+  case EXPR_FUNC:
+    gen_func_addr(expr);
+    break;
+  case EXPR_CAST:
+    gen_cast(expr);
+    break;
+  case EXPR_STR:
+    gen_str(expr);
+    break;
+  default:
+    error("unknown case");
+    break;
   }
+}
+
+int has_value(expr_t *expr)
+{
+  switch (expr->texpr) {
+  case EXPR_BINOP:
+    return expr->binop.op != OPERATOR_ASSIGN;
+  case EXPR_CALL:
+    return expr->type.spec != NULL;
+  default:
+    return 1;
+  }
+}
+
+void gen_str(expr_t *expr)
+{
+  data_t *data = find_data_str(expr->str_hash);
   
   emit(PUSH);
-  emit(data->pos);
+  int pos = emit(data->pos);
+  
+  emit_reloc(RELOC_DATA, pos, 0);
+  frag_ref(RELOC_DATA, pos, expr->str_hash);
 }
 
 void gen_cast(expr_t *expr)
@@ -365,10 +926,29 @@ void gen_call(expr_t *expr)
     arg = arg->arg.next;
   }
   
+  if (func->native >= 0) {
+    emit(NCALL);
+    emit(func->native);
+    return;
+  }
+  
+  if (func->intrinsic >= 0) {
+    emit(func->intrinsic);
+    return;
+  }
+  
   emit(CALL);
   int pos = emit(0);
   
-  set_replace(func->name, pos);
+  set_func_replace(func, pos);
+}
+
+void gen_func_addr(expr_t *expr)
+{
+  emit(PUSH);
+  int pos = emit(0);
+  
+  set_func_replace(expr->func.func, pos);
 }
 
 void gen_const(expr_t *expr)
@@ -379,9 +959,12 @@ void gen_const(expr_t *expr)
 
 void gen_addr(expr_t *expr)
 {
+  if (par_active && gen_par_addr(expr))
+    return;
+  
   switch (expr->addr.taddr) {
   case ADDR_GLOBAL:
-    gen_expr(expr->addr.base);
+    gen_global_addr(expr->addr.base);
     break;
   case ADDR_LOCAL:
     emit(LBP);
@@ -529,10 +1112,7 @@ void gen_binop_cond(expr_t *expr)
   
   emit(PUSH);
   emit(1);
-  emit(JMP);
-  int pos = emit(0);
-  
-  set_replace(body_end, pos);
+  emit_label(JMP, body_end);
   
   set_label(cond_end);
   
@@ -629,40 +1209,46 @@ hash_t tmp_label()
 
 void set_label(hash_t name)
 {
-  if (label_list) {
-    label_t *head = label_list;
-    while (head->next) {
-      if (name == head->name)
-        error("duplicate label '%s'", hash_get(name));
-      
-      head = head->next;
-    }
-    
-    if (name == head->name)
-      error("duplicate label '%s'", hash_get(name));
-    
-    head->next = make_label(name, num_instr);
-  } else {
-    label_list = make_label(name, num_instr);
-  }
+  label_t *label = make_label(name, num_instr);
+  
+  if (!map_put(map_label, name, label))
+    error("duplicate label '%s'", hash_get(name));
+  
+  if (label_list)
+    label_head = label_head->next = label;
+  else
+    label_list = label_head = label;
 }
 
 void set_replace(hash_t name, int pos)
 {
-  replace_t *replace = map_get(map_replace, name);
+  replace_t *head = map_get(map_replace, name);
   
-  if (replace) {
-    replace_t *head = replace;
-    
-    while (head->next)
-      head = head->next;
-    
-    head->next = make_replace(pos);
+  if (head) {
+    replace_t *replace = make_replace(pos);
+    replace->next = head->next;
+    head->next = replace;
   } else {
     map_put(map_replace, name, make_replace(pos));
   }
 }
 
+void set_func_replace(func_t *func, int pos)
+{
+  frag_ref(RELOC_SYM, pos, func->name);
+  block_ref(func->name);
+  
+  if (func->body || func->frag) {
+    set_replace(func->name, pos);
+    return;
+  }
+  
+  if (!gen_object)
+    error("undefined function '%s'", hash_get(func->name));
+  
+  emit_reloc(RELOC_SYM, pos, func->name);
+}
+
 void replace_all()
 {
   label_t *label = label_list;
@@ -670,7 +1256,11 @@ void replace_all()
     replace_t *replace = map_get(map_replace, label->name);
     
     while (replace) {
-      instr_buf[replace->pos] = label->pos;
+      if (replace->pos >= 0) {
+        instr_buf[replace->pos] = label->pos;
+        emit_reloc(RELOC_CODE, replace->pos, 0);
+        add_jump(replace->pos);
+      }
       
       replace = replace->next;
     }
@@ -679,6 +1269,384 @@ void replace_all()
   }
 }
 
+void begin_block(hash_t name)
+{
+  if (num_block > 0)
+    block_buf[num_block - 1]->end = num_instr;
+  
+  if (num_block >= max_block) {
+    max_block *= 2;
+    block_buf = realloc(block_buf, max_block * sizeof(block_t*));
+  }
+  
+  block_t *block = malloc(sizeof(block_t));
+  block->name = name;
+  block->start = num_instr;
+  block->end = num_instr;
+  block->shift = 0;
+  block->f_live = 0;
+  block->max_ref = 8;
+  block->num_ref = 0;
+  block->ref = malloc(block->max_ref * sizeof(hash_t));
+  
+  block_buf[num_block++] = block;
+  
+  if (name)
+    map_put(map_block, name, block);
+}
+
+void block_ref(hash_t name)
+{
+  block_t *block = block_buf[num_block - 1];
+  
+  if (block->num_ref >= block->max_ref) {
+    block->max_ref *= 2;
+    block->ref = realloc(block->ref, block->max_ref * sizeof(hash_t));
+  }
+  
+  block->ref[block->num_ref++] = name;
+}
+
+static void mark_block(block_t *block)
+{
+  if (block->f_live)
+    return;
+  
+  block->f_live = 1;
+  
+  for (int i = 0; i < block->num_ref; i++) {
+    block_t *callee = map_get(map_block, block->ref[i]);
+    if (callee)
+      mark_block(callee);
+  }
+}
+
+static block_t *find_block(int pos)
+{
+  int lo = 0, hi = num_block - 1;
+  
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    
+    if (block_buf[mid]->start <= pos)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  
+  return block_buf[lo];
+}
+
+static int is_dead(int pos)
+{
+  return !find_block(pos)->f_live;
+}
+
+static int shift_pos(int pos)
+{
+  block_t *block = find_block(pos);
+  
+  if (block->f_live)
+    return pos - block->shift;
+  else
+    return block->start - block->shift;
+}
+
+void remove_dead()
+{
+  block_buf[num_block - 1]->end = num_instr;
+  
+  mark_block(block_buf[0]);
+  
+  for (int i = 0; i < num_export; i++)
+    mark_block(map_get(map_block, export_buf[i].name));
+  
+  int shift = 0;
+  
+  for (int i = 0; i < num_block; i++) {
+    block_t *block = block_buf[i];
+    block->shift = shift;
+    
+    if (block->f_live)
+      memmove(&instr_buf[block->start - shift], &instr_buf[block->start], (block->end - block->start) * sizeof(instr_t));
+    else
+      shift += block->end - block->start;
+  }
+  
+  int n = 0;
+  for (int i = 0; i < num_jump; i++) {
+    if (!is_dead(jump_buf[i])) {
+      int pos = shift_pos(jump_buf[i]);
+      instr_buf[pos] = shift_pos(instr_buf[pos]);
+      jump_buf[n++] = pos;
+    }
+  }
+  
+  num_jump = n;
+  
+  for (label_t *label = label_list; label; label = label->next) {
+    for (replace_t *replace = map_get(map_replace, label->name); replace; replace = replace->next)
+      replace->pos = is_dead(replace->pos) ? -1 : shift_pos(replace->pos);
+    
+    label->pos = shift_pos(label->pos);
+  }
+  
+  n = 0;
+  for (int i = 0; i < num_sym; i++) {
+    if (!is_dead(sym_buf[i].pos)) {
+      sym_buf[n] = sym_buf[i];
+      sym_buf[n++].pos = shift_pos(sym_buf[i].pos);
+    }
+  }
+  
+  num_sym = n;
+  
+  n = 0;
+  for (int i = 0; i < num_line; i++) {
+    if (!is_dead(line_buf[i].pos)) {
+      line_buf[n] = line_buf[i];
+      line_buf[n++].pos = shift_pos(line_buf[i].pos);
+    }
+  }
+  
+  num_line = n;
+  
+  for (int i = 0; i < num_export; i++)
+    export_buf[i].pos = shift_pos(export_buf[i].pos);
+  
+  n = 0;
+  for (int i = 0; i < num_reloc; i++) {
+    if (!is_dead(reloc_buf[i].pos)) {
+      reloc_buf[n] = reloc_buf[i];
+      reloc_buf[n++].pos = shift_pos(reloc_buf[i].pos);
+    }
+  }
+  
+  num_reloc = n;
+  num_instr -= shift;
+  
+  for (int i = 0; i < num_block; i++) {
+    free(block_buf[i]->ref);
+    free(block_buf[i]);
+  }
+  
+  free(block_buf);
+}
+
+void add_jump(int pos)
+{
+  if (num_jump >= max_jump) {
+    max_jump *= 2;
+    jump_buf = realloc(jump_buf, max_jump * sizeof(int));
+  }
+  
+  jump_buf[num_jump++] = pos;
+}
+
+static int is_jump(instr_t instr)
+{
+  return instr == JMP || (instr >= JE && instr <= JGE);
+}
+
+static int fold(instr_t op, int a, int b)
+{
+  switch (op) {
+  case ADD:
+    return (unsigned) a + (unsigned) b;
+  case SUB:
+    return (unsigned) a - (unsigned) b;
+  default:
+    return (unsigned) a * (unsigned) b;
+  }
+}
+
+static int find_consumer(int pos, char *f_target)
+{
+  int depth = 0;
+  
+  for (int n = 0; n < 32 && pos < num_instr && !f_target[pos]; n++) {
+    switch (instr_buf[pos]) {
+    case PUSH:
+    case LBP:
+      depth++;
+      break;
+    case LDR:
+    case LDR8:
+    case SX8_32:
+    case SX32_8:
+      if (depth < 1)
+        return -1;
+      break;
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+    case MOD:
+      if (depth == 1)
+        return pos;
+      else if (depth < 1)
+        return -1;
+      depth--;
+      break;
+    default:
+      return -1;
+    }
+    
+    pos += instr_size(instr_buf[pos]);
+  }
+  
+  return -1;
+}
+
+static void thread_jumps()
+{
+  for (int i = 0; i < num_jump; i++) {
+    int pos = jump_buf[i];
+    
+    if (!is_jump(instr_buf[pos - 1]))
+      continue;
+    
+    int target = instr_buf[pos];
+    for (int hop = 0; hop < 16 && target < num_instr && instr_buf[target] == JMP; hop++)
+      target = instr_buf[target + 1];
+    
+    instr_buf[pos] = target;
+  }
+}
+
+static int peephole_pass()
+{
+  char *f_target = calloc(num_instr + 1, 1);
+  char *f_fixed = calloc(num_instr + 1, 1);
+  char *f_drop = calloc(num_instr + 1, 1);
+  int *new_pos = malloc((num_instr + 1) * sizeof(int));
+  
+  thread_jumps();
+  
+  for (int i = 0; i < num_jump; i++) {
+    f_fixed[jump_buf[i]] = 1;
+    f_target[instr_buf[jump_buf[i]]] = 1;
+  }
+  
+  for (int i = 0; i < num_reloc; i++)
+    f_fixed[reloc_buf[i].pos] = 1;
+  
+  int n = 0;
+  int i = 0;
+  int removed = 0;
+  
+  while (i < num_instr) {
+    instr_t *c = &instr_buf[i];
+    int keep = instr_size(c[0]);
+    int drop = 0;
+    int end;
+    
+    if (f_drop[i]) {
+      keep = 0;
+      drop = 1;
+    } else if (c[0] == PUSH && i + 2 < num_instr && !f_fixed[i + 1] && !f_target[i + 2] && !f_drop[i + 2]
+    && (((c[2] == ADD || c[2] == SUB) && c[1] == 0) || (c[2] == MUL && c[1] == 1))) {
+      keep = 0;
+      drop = 3;
+      removed += 2;
+    } else if (c[0] == PUSH && i + 4 < num_instr && c[2] == PUSH && (c[4] == ADD || c[4] == SUB || c[4] == MUL)
+    && !f_fixed[i + 1] && !f_fixed[i + 3] && !f_target[i + 2] && !f_target[i + 4] && !f_drop[i + 4]) {
+      c[1] = fold(c[4], c[1], c[3]);
+      keep = 2;
+      drop = 3;
+      removed += 2;
+    } else if (c[0] == PUSH && !f_fixed[i + 1] && (c[1] == 0 || c[1] == 1)
+    && (end = find_consumer(i + 2, f_target)) >= 0 && instr_buf[end] == (c[1] ? MUL : ADD)) {
+      f_drop[end] = 1;
+      keep = 0;
+      drop = 2;
+      removed += 2;
+    } else if (c[0] == JMP && i + 1 < num_instr && (int) c[1] == i + 2) {
+      keep = 0;
+      drop = 2;
+      removed++;
+    }
+    
+    for (int j = 0; j < keep; j++) {
+      new_pos[i] = n;
+      instr_buf[n++] = instr_buf[i++];
+    }
+    
+    for (int j = 0; j < drop; j++) {
+      new_pos[i] = n;
+      f_drop[i++] = 1;
+    }
+  }
+  
+  new_pos[num_instr] = n;
+  num_instr = n;
+  
+  n = 0;
+  for (i = 0; i < num_jump; i++) {
+    if (!f_drop[jump_buf[i]]) {
+      int pos = new_pos[jump_buf[i]];
+      instr_buf[pos] = new_pos[instr_buf[pos]];
+      jump_buf[n++] = pos;
+    }
+  }
+  
+  num_jump = n;
+  
+  n = 0;
+  for (i = 0; i < num_reloc; i++) {
+    if (!f_drop[reloc_buf[i].pos]) {
+      reloc_buf[n] = reloc_buf[i];
+      reloc_buf[n++].pos = new_pos[reloc_buf[i].pos];
+    }
+  }
+  
+  num_reloc = n;
+  
+  for (i = 0; i < num_sym; i++)
+    sym_buf[i].pos = new_pos[sym_buf[i].pos];
+  
+  for (i = 0; i < num_export; i++)
+    export_buf[i].pos = new_pos[export_buf[i].pos];
+  
+  n = 0;
+  for (i = 0; i < num_line; i++) {
+    int pos = new_pos[line_buf[i].pos];
+    
+    if (n > 0 && line_buf[n - 1].pos == pos)
+      n--;
+    
+    line_buf[n] = line_buf[i];
+    line_buf[n++].pos = pos;
+  }
+  
+  num_line = n;
+  
+  free(f_target);
+  free(f_fixed);
+  free(f_drop);
+  free(new_pos);
+  
+  return removed;
+}
+
+void gen_dump()
+{
+  if (gen_removed >= 0)
+    printf("peephole: %i instructions removed\n", gen_removed);
+  
+  gen_removed = -1;
+}
+
+int peephole()
+{
+  int removed = 0, n;
+  
+  while ((n = peephole_pass()) > 0)
+    removed += n;
+  
+  return removed;
+}
+
 tspec_t simplify_type_spec(type_t *type)
 {
   if (type->dcltr) {
@@ -688,6 +1656,9 @@ tspec_t simplify_type_spec(type_t *type)
     }
   }
   
+  if (type->spec->tspec == TY_REGION)
+    return TY_I32;
+  
   return type->spec->tspec;
 }
 
@@ -736,7 +1707,7 @@ int emit(instr_t instr)
 {
   if (num_instr >= max_instr) {
     max_instr += 1024;
-    instr_buf = realloc(instr_buf, max_instr);
+    instr_buf = realloc(instr_buf, max_instr * sizeof(instr_t));
   }
   
   int cache_pos = num_instr;
@@ -763,6 +1734,19 @@ void emit_label(instr_t instr, hash_t lbl)
   int pos = emit(0);
   
   set_replace(lbl, pos);
+  frag_ref(RELOC_CODE, pos, lbl);
+}
+
+data_t *find_data_str(hash_t str_hash)
+{
+  data_t *data = map_get(map_data, str_hash);
+  
+  if (!data) {
+    data = emit_data_str(str_hash);
+    map_put(map_data, str_hash, data);
+  }
+  
+  return data;
 }
 
 data_t *emit_data_str(hash_t str_hash)
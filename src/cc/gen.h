@@ -4,6 +4,7 @@
 #include "parse.h"
 #include "../vm/bin.h"
 
-bin_t *gen(unit_t *unit);
+bin_t *gen(unit_t *unit, int f_object);
+void gen_dump();
 
 #endif
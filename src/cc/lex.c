@@ -1,5 +1,6 @@
 #include "lex.h"
 
+#include "pch.h"
 #include "../common/error.h"
 #include <stdlib.h>
 #include <stdarg.h>
@@ -7,6 +8,7 @@
 
 #define MAX_OP 4
 #define MAX_WORD 32
+#define SKIP_CHUNK 256
 
 typedef struct op_s op_t;
 typedef struct keyword_s keyword_t;
@@ -55,7 +57,14 @@ const char *token_str[] = {
   "return",
   "break",
   "else",
-  "asm"
+  "struct",
+  "asm",
+  "argc",
+  "argv",
+  "extern",
+  "par",
+  "reduce",
+  "region"
 };
 
 op_t op_dict[] = {
@@ -120,9 +129,18 @@ keyword_t keyword_dict[] = {
   { "struct",   TK_STRUCT       },
   { "asm",      TK_ASM          },
   { "argc",     TK_ARGC         },
-  { "argv",     TK_ARGV         }
+  { "argv",     TK_ARGV         },
+  { "extern",   TK_EXTERN       },
+  { "par",      TK_PAR          },
+  { "reduce",   TK_REDUCE       },
+  { "region",   TK_REGION       }
 };
 
+static char *skip_buf;
+static int skip_len;
+static int skip_max;
+static int skip_read;
+
 const int op_dict_count = sizeof(op_dict) / sizeof(op_t);
 const int keyword_dict_count = sizeof(keyword_dict) / sizeof(keyword_t);
 
@@ -378,12 +396,7 @@ int read_constant()
 
 int keyword_match(keyword_t *keyword, const char *word)
 {
-  for (int i = 0; i < strlen(keyword->key); i++) {
-    if (word[i] != keyword->key[i])
-      return 0;
-  }
-  
-  return 1; 
+  return strcmp(keyword->key, word) == 0;
 }
 
 int read_word()
@@ -556,9 +569,9 @@ char *filename()
     char *dir = strndup(lex.fid->fname, slash - lex.fid->fname);
     int len = strlen(dir);
     
-    dir = realloc(dir, strlen(dir) + pos + 1);
+    dir = realloc(dir, len + pos + 1);
     dir[len] = '/';
-    strcat(dir + 1, buf);
+    strcpy(dir + len + 1, buf);
     
     free(buf);
     
@@ -577,6 +590,12 @@ void preprocess()
     if (!fname)
       token_error("#include expects \"FILENAME\"");
     
+    if (pch_include(fname)) {
+      free(fname);
+      next();
+      return;
+    }
+    
     FILE *in = fopen(fname, "rb");
     if (!in)
       token_error("could not open '%s'", fname);
@@ -587,6 +606,7 @@ void preprocess()
 
 void unlexify()
 {
+  pch_pop();
   fclose(lex.fid->file);
   free(lex.fid->fname);
   --lex.fid;
@@ -638,6 +658,127 @@ void next()
   }
 }
 
+static char skip_at(int i)
+{
+  while (skip_len <= i) {
+    if (skip_len + SKIP_CHUNK > skip_max) {
+      skip_max = skip_max ? skip_max * 2 : 4 * SKIP_CHUNK;
+      skip_buf = realloc(skip_buf, skip_max);
+    }
+    
+    int num_ahead = &lex.fid->tmp_buf[MAX_TMP] - lex.fid->c;
+    
+    if (skip_len < num_ahead) {
+      memcpy(skip_buf, lex.fid->c, num_ahead);
+      skip_len = num_ahead;
+    } else {
+      int num_read = fread(&skip_buf[skip_len], 1, SKIP_CHUNK, lex.fid->file);
+      memset(&skip_buf[skip_len + num_read], EOF, SKIP_CHUNK - num_read);
+      skip_len += SKIP_CHUNK;
+      skip_read += num_read;
+    }
+  }
+  
+  return skip_buf[i];
+}
+
+static int skip_next(int i, int *depth)
+{
+  char c;
+  
+  switch (skip_at(i++)) {
+  case '{':
+    (*depth)++;
+    break;
+  case '}':
+    (*depth)--;
+    break;
+  case '"':
+    while ((c = skip_at(i++)) != '"') {
+      if (c == EOF)
+        return -1;
+      
+      if (c == '\\')
+        skip_at(i++);
+    }
+    break;
+  case '\'':
+    if (skip_at(i++) == '\\')
+      skip_at(i++);
+    
+    if (skip_at(i) == '\'')
+      i++;
+    break;
+  case '/':
+    if (skip_at(i) == '/') {
+      while ((c = skip_at(i++)) != '\n') {
+        if (c == EOF)
+          return -1;
+      }
+    } else if (skip_at(i) == '*') {
+      i++;
+      while (skip_at(i) != '*' && skip_at(i + 1) != '/') {
+        if (skip_at(i) == EOF)
+          return -1;
+        i++;
+      }
+      i += 2;
+    }
+    break;
+  case EOF:
+  case '#':
+    return -1;
+  }
+  
+  return i;
+}
+
+const char *lex_skip_block(int *len)
+{
+  lex.mark = *lex.fid;
+  lex.mark_pos = ftell(lex.fid->file);
+  
+  skip_len = 0;
+  skip_read = 0;
+  
+  int depth = 1;
+  int i = 0;
+  
+  while (depth > 0) {
+    if ((i = skip_next(i, &depth)) < 0) {
+      lex_unskip();
+      return NULL;
+    }
+  }
+  
+  for (int j = 0; j < i; j++) {
+    if (skip_buf[j] == '\n')
+      lex.fid->line_no++;
+  }
+  
+  int num_ahead = &lex.fid->tmp_buf[MAX_TMP] - lex.fid->c;
+  
+  if (i < num_ahead) {
+    fseek(lex.fid->file, -skip_read, SEEK_CUR);
+    lex.fid->c += i;
+  } else {
+    fseek(lex.fid->file, i - num_ahead - skip_read, SEEK_CUR);
+    lex.fid->c = &lex.fid->tmp_buf[MAX_TMP];
+  }
+  
+  populate_buffer();
+  
+  *len = i;
+  
+  return skip_buf;
+}
+
+void lex_unskip()
+{
+  fseek(lex.mark.file, lex.mark_pos, SEEK_SET);
+  *lex.fid = lex.mark;
+}
+
 void lex_init()
 {
   lex.fid = lex.fstack;
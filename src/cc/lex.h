@@ -49,7 +49,11 @@ enum token_e {
   TK_STRUCT,
   TK_ASM,
   TK_ARGC,
-  TK_ARGV
+  TK_ARGV,
+  TK_EXTERN,
+  TK_PAR,
+  TK_REDUCE,
+  TK_REGION
 };
 
 struct file_s {
@@ -67,6 +71,9 @@ struct lex_s {
   token_t token;
   int     token_num;
   hash_t  token_hash;
+  
+  file_t  mark;
+  long    mark_pos;
 };
 
 extern lex_t lex;
@@ -75,6 +82,8 @@ void lex_init();
 void lexify(FILE *file, char *fname);
 void next();
 void match(token_t tok);
+const char *lex_skip_block(int *len);
+void lex_unskip();
 void token_error(const char *fmt, ...);
 void token_warning(const char *fmt, ...);
 
@@ -46,6 +46,7 @@ stmt_t *statement();
 stmt_t *compound_statement();
 stmt_t *if_statement();
 stmt_t *while_statement();
+stmt_t *par_statement();
 stmt_t *expression_statement();
 stmt_t *return_statement();
 stmt_t *inline_asm_statement();
@@ -54,15 +55,20 @@ stmt_t *declaration_statement();
 stmt_t *make_expr_stmt(expr_t *expr);
 stmt_t *make_decl_stmt(decl_t *decl);
 stmt_t *make_while_stmt(expr_t *cond, stmt_t *body);
+stmt_t *make_par_stmt(expr_t *var, expr_t *limit, expr_t *reduce, stmt_t *body, int local_lo, int local_hi);
 stmt_t *make_if_stmt(expr_t *cond, stmt_t *body, stmt_t *next_if, stmt_t *else_body);
 stmt_t *make_ret_stmt(expr_t *value);
 stmt_t *make_inline_asm_stmt(char *code);
+int is_par_var(expr_t *expr);
+int is_par_counter(expr_t *expr);
 
 //
 // decl.c
 //
 void decl_init();
+void intrinsic_init();
 func_t *func_declaration();
+int extern_declaration();
 param_t *func_params();
 void func_type(type_t *type);
 int struct_declaration();
@@ -78,6 +84,7 @@ param_t *param_type_list();
 param_t *param_declaration();
 decl_t *insert_decl(scope_t *scope, spec_t *spec, dcltr_t *dcltr, expr_t *init, hash_t name, int align_32);
 int is_type_match(type_t *lhs, type_t *rhs);
+int is_proto_match(func_t *func, type_t *type, param_t *params);
 int type_size(spec_t *spec, dcltr_t *dcltr);
 int type_align(spec_t *spec, dcltr_t *dcltr);
 spec_t *spec_cache_find(tspec_t tspec, scope_t *struct_scope);
@@ -91,4 +98,12 @@ decl_t *make_decl(spec_t *spec, dcltr_t *dcltr, expr_t *init, int offset);
 param_t *make_param(spec_t *spec, dcltr_t *dcltr, expr_t *addr);
 func_t *make_func(hash_t name, type_t *type, param_t *params, stmt_t *body, int local_size);
 
+//
+// autopar.c
+//
+void autopar_init(int f_autopar);
+loop_t *autopar_begin();
+void autopar_end(loop_t *loop, stmt_t *stmt);
+void autopar(unit_t *unit);
+
 #endif
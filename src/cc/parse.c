@@ -1,10 +1,12 @@
 #include "p_local.h"
 
+#include "pch.h"
 #include <stdlib.h>
 
-void parse_init()
+void parse_init(int f_autopar)
 {
   decl_init();
+  autopar_init(f_autopar);
 }
 
 unit_t *make_unit(func_t *func, stmt_t *stmt, scope_t *scope)
@@ -21,8 +23,11 @@ unit_t *translation_unit()
   func_t *func_body = NULL, *func_head, *func;
   stmt_t *stmt_body = NULL, *stmt_head = NULL, *stmt = NULL;
   
-  while (lex.token != EOF) {
-    if ((func = func_declaration())) {
+  while (lex.token != EOF || pch_pending()) {
+    if ((func = pch_func()) || (func = func_declaration())) {
+      if (!func->body && !func->frag)
+        continue;
+      
       if (func_body)
         func_head = func_head->next = func;
       else
@@ -32,10 +37,14 @@ unit_t *translation_unit()
         stmt_head = stmt_head->next = stmt;
       else
         stmt_body = stmt_head = stmt;
-    } else {
+    } else if (!extern_declaration()) {
       struct_declaration();
     }
   }
   
-  return make_unit(func_body, stmt_body, scope_global);
+  unit_t *unit = make_unit(func_body, stmt_body, scope_global);
+  
+  autopar(unit);
+  
+  return unit;
 }
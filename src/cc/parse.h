@@ -12,8 +12,10 @@ typedef struct dcltr_s dcltr_t;
 typedef struct type_s type_t;
 typedef struct decl_s decl_t;
 typedef struct func_s func_t;
+typedef struct frag_s frag_t;
 typedef struct param_s param_t;
 typedef struct scope_s scope_t;
+typedef struct loop_s loop_t;
 
 typedef enum operator_e operator_t;
 typedef enum texpr_e texpr_t;
@@ -29,6 +31,7 @@ enum tspec_e {
   TY_U0,
   TY_I8,
   TY_I32,
+  TY_REGION,
   TY_STRUCT,
   TY_FUNC
 };
@@ -78,7 +81,8 @@ enum tstmt_e {
   STMT_IF,
   STMT_WHILE,
   STMT_RETURN,
-  STMT_INLINE_ASM
+  STMT_INLINE_ASM,
+  STMT_PAR
 };
 
 struct spec_s {
@@ -105,6 +109,7 @@ struct decl_s {
   int offset;
   expr_t *init;
   decl_t *next;
+  decl_t *prev;
 };
 
 struct param_s {
@@ -119,13 +124,21 @@ struct func_s {
   stmt_t *body;
   param_t *params;
   int local_size;
+  int native;
+  int intrinsic;
+  frag_t *frag;
+  frag_t *frag_rec;
+  int frag_line;
+  int f_header;
   func_t *next;
 };
 
 struct scope_s {
+  hash_t name;
   map_t map;
   taddr_t taddr;
   int size;
+  decl_t *decl;
 };
 
 struct expr_s {
@@ -171,6 +184,7 @@ struct stmt_s {
     struct {
       expr_t *cond;
       stmt_t *body;
+      loop_t *loop;
     } while_stmt;
     struct {
       expr_t *value;
@@ -181,8 +195,19 @@ struct stmt_s {
     struct {
       char *code;
     } inline_asm_stmt;
+    struct {
+      expr_t *var;
+      expr_t *limit;
+      expr_t *reduce;
+      stmt_t *body;
+      taddr_t taddr;
+      int local_lo;
+      int local_hi;
+    } par_stmt;
   };
   tstmt_t tstmt;
+  hash_t file;
+  int line;
   stmt_t *next;
 };
 
@@ -192,7 +217,7 @@ struct unit_s {
   scope_t scope;
 };
 
-void parse_init();
+void parse_init(int f_autopar);
 unit_t *translation_unit();
 
 #endif
@@ -0,0 +1,409 @@
+#include "pch.h"
+
+#include "p_local.h"
+#include "frag.h"
+#include "../cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+int pch_enabled = 0;
+
+static int pch_f_read;
+static frag_key_t pch_state;
+
+static note_t *note = NULL;
+static int num_note = 0;
+static int max_note = 0;
+
+static pch_t *pch_open;
+static pch_t *pch_done;
+
+static func_t *queue_head;
+static func_t *queue_tail;
+
+void pch_init(int f_read)
+{
+  pch_enabled = 1;
+  pch_f_read = f_read;
+  pch_state = 0;
+  num_note = 0;
+  pch_open = NULL;
+  pch_done = NULL;
+  queue_head = NULL;
+  queue_tail = NULL;
+}
+
+void pch_note(tnote_t tnote, hash_t name)
+{
+  if (!pch_enabled)
+    return;
+  
+  if (num_note >= max_note) {
+    max_note = max_note ? max_note * 2 : 256;
+    note = realloc(note, max_note * sizeof(note_t));
+  }
+  
+  note[num_note].tnote = tnote;
+  note[num_note].name = name;
+  num_note++;
+  
+  pch_state = frag_hash_ident(pch_state, name);
+}
+
+static void pch_add_file(pch_t *pch, hash_t file)
+{
+  pch->file = realloc(pch->file, (pch->num_file + 1) * sizeof(hash_t));
+  pch->file[pch->num_file++] = file;
+}
+
+static pch_t *make_pch(char *fname, unsigned long key)
+{
+  pch_t *pch = malloc(sizeof(pch_t));
+  pch->fname = strdup(fname);
+  pch->key = key;
+  pch->depth = lex.fid - lex.fstack + 1;
+  pch->note_lo = num_note;
+  pch->note_hi = num_note;
+  pch->file = NULL;
+  pch->num_file = 0;
+  pch->next = NULL;
+  return pch;
+}
+
+int pch_include(char *fname)
+{
+  if (!pch_enabled)
+    return 0;
+  
+  cache_key_t key = cache_key(fname, 0);
+  if (!key)
+    return 0;
+  
+  key ^= pch_state;
+  
+  if (pch_f_read) {
+    switch (cache_read_pch(fname, key)) {
+    case 1:
+      return 1;
+    case -1:
+      token_error("corrupt header cache for '%s'", fname);
+      break;
+    }
+  }
+  
+  pch_t *pch = make_pch(fname, key);
+  pch->next = pch_open;
+  pch_open = pch;
+  
+  for (pch = pch_open; pch; pch = pch->next)
+    pch_add_file(pch, hash_value(fname));
+  
+  return 0;
+}
+
+void pch_pop()
+{
+  if (!pch_open || pch_open->depth != lex.fid - lex.fstack)
+    return;
+  
+  pch_t *pch = pch_open;
+  pch_open = pch->next;
+  
+  pch->note_hi = num_note;
+  pch->next = pch_done;
+  pch_done = pch;
+}
+
+func_t *pch_func()
+{
+  func_t *func = queue_head;
+  
+  if (func) {
+    queue_head = func->next;
+    func->next = NULL;
+  }
+  
+  return func;
+}
+
+int pch_pending()
+{
+  return queue_head != NULL;
+}
+
+static frag_t *func_frag(func_t *func)
+{
+  return func->frag ? func->frag : func->frag_rec;
+}
+
+static int is_pch_clean(pch_t *pch, unit_t *unit)
+{
+  for (stmt_t *stmt = unit->stmt; stmt; stmt = stmt->next) {
+    if (stmt->tstmt == STMT_EXPR && !stmt->expr)
+      continue;
+    
+    for (int i = 0; i < pch->num_file; i++) {
+      if (stmt->file == pch->file[i])
+        return 0;
+    }
+  }
+  
+  for (int i = pch->note_lo; i < pch->note_hi; i++) {
+    if (note[i].tnote == NOTE_FUNC && !func_frag(map_get(scope_func, note[i].name)))
+      return 0;
+  }
+  
+  return 1;
+}
+
+void pch_flush(unit_t *unit)
+{
+  for (pch_t *pch = pch_done; pch; pch = pch->next) {
+    if (is_pch_clean(pch, unit))
+      cache_write_pch(pch->fname, pch->key, pch);
+  }
+}
+
+static void put_type(FILE *out, type_t *type)
+{
+  if (!type->spec) {
+    frag_put_int(out, 0);
+    return;
+  }
+  
+  frag_put_int(out, type->spec->tspec + 1);
+  
+  if (type->spec->tspec == TY_STRUCT)
+    frag_put_str(out, type->spec->struct_scope->name);
+  
+  int num_dcltr = 0;
+  for (dcltr_t *dcltr = type->dcltr; dcltr; dcltr = dcltr->next)
+    num_dcltr++;
+  
+  frag_put_int(out, num_dcltr);
+  
+  for (dcltr_t *dcltr = type->dcltr; dcltr; dcltr = dcltr->next) {
+    frag_put_int(out, dcltr->type);
+    frag_put_int(out, dcltr->type == DCLTR_ARRAY ? dcltr->size : 0);
+  }
+}
+
+static int get_type(FILE *in, type_t *type)
+{
+  int tspec, num_dcltr;
+  
+  type->spec = NULL;
+  type->dcltr = NULL;
+  
+  if (!frag_get_int(in, &tspec) || tspec > TY_FUNC + 1)
+    return 0;
+  
+  if (!tspec)
+    return 1;
+  
+  hash_t name;
+  scope_t *struct_scope = NULL;
+  
+  if (tspec - 1 == TY_STRUCT && (!frag_get_str(in, &name) || !(struct_scope = map_get(scope_struct, name))))
+    return 0;
+  
+  type->spec = spec_cache_find(tspec - 1, struct_scope);
+  
+  if (!frag_get_int(in, &num_dcltr))
+    return 0;
+  
+  dcltr_t **tail = &type->dcltr;
+  
+  for (int i = 0; i < num_dcltr; i++) {
+    int tdcltr, size;
+    if (!frag_get_int(in, &tdcltr) || !frag_get_int(in, &size))
+      return 0;
+    
+    *tail = tdcltr == DCLTR_ARRAY ? make_dcltr_array(size, NULL) : make_dcltr_pointer(NULL);
+    tail = &(*tail)->next;
+  }
+  
+  return 1;
+}
+
+static void write_struct(FILE *out, scope_t *scope)
+{
+  int num_member = 0;
+  for (decl_t *decl = scope->decl; decl; decl = decl->prev)
+    num_member++;
+  
+  decl_t **member = malloc((num_member + 1) * sizeof(decl_t*));
+  
+  int i = num_member;
+  for (decl_t *decl = scope->decl; decl; decl = decl->prev)
+    member[--i] = decl;
+  
+  frag_put_int(out, num_member);
+  
+  for (i = 0; i < num_member; i++) {
+    frag_put_str(out, member[i]->name);
+    put_type(out, &member[i]->type);
+  }
+  
+  free(member);
+}
+
+static int read_struct(FILE *in, hash_t name)
+{
+  int num_member;
+  if (!frag_get_int(in, &num_member))
+    return 0;
+  
+  scope_t *scope = make_scope(ADDR_LOCAL);
+  scope->name = name;
+  
+  for (int i = 0; i < num_member; i++) {
+    hash_t member;
+    type_t type;
+    
+    if (!frag_get_str(in, &member) || !get_type(in, &type) || !type.spec)
+      return 0;
+    
+    insert_decl(scope, type.spec, type.dcltr, NULL, member, 0);
+  }
+  
+  return map_put(scope_struct, name, scope);
+}
+
+static void write_func(FILE *out, tnote_t tnote, func_t *func)
+{
+  put_type(out, &func->type);
+  
+  int num_param = 0;
+  for (param_t *param = func->params; param; param = param->next)
+    num_param++;
+  
+  frag_put_int(out, num_param);
+  
+  for (param_t *param = func->params; param; param = param->next) {
+    put_type(out, &param->type);
+    frag_put_int(out, param->addr->addr.base->num);
+  }
+  
+  if (tnote == NOTE_EXTERN) {
+    frag_put_int(out, func->native);
+  } else if (tnote == NOTE_FUNC) {
+    frag_put_int(out, func->frag_line);
+    frag_save(out, func_frag(func));
+  }
+}
+
+static int read_func(FILE *in, tnote_t tnote, hash_t name)
+{
+  type_t type;
+  int num_param;
+  
+  if (!get_type(in, &type) || !frag_get_int(in, &num_param))
+    return 0;
+  
+  param_t *params = NULL, *head = NULL;
+  
+  for (int i = 0; i < num_param; i++) {
+    type_t param_type;
+    int offset;
+    
+    if (!get_type(in, &param_type) || !param_type.spec || !frag_get_int(in, &offset))
+      return 0;
+    
+    expr_t *addr = make_addr(make_const(offset), ADDR_LOCAL, &param_type);
+    param_t *param = make_param(param_type.spec, param_type.dcltr, addr);
+    
+    if (head)
+      head = head->next = param;
+    else
+      params = head = param;
+  }
+  
+  func_t *func = map_get(scope_func, name);
+  
+  if (!func) {
+    func = make_func(name, &type, params, NULL, 0);
+    map_put(scope_func, name, func);
+  } else {
+    func->params = params;
+  }
+  
+  if (tnote == NOTE_EXTERN) {
+    if (!frag_get_int(in, &func->native))
+      return 0;
+  } else if (tnote == NOTE_FUNC) {
+    if (!frag_get_int(in, &func->frag_line) || !(func->frag = frag_load(in)))
+      return 0;
+    
+    func->f_header = 1;
+    
+    if (queue_head)
+      queue_tail = queue_tail->next = func;
+    else
+      queue_head = queue_tail = func;
+  }
+  
+  return 1;
+}
+
+int pch_read(FILE *in)
+{
+  int num;
+  if (!frag_get_int(in, &num))
+    return 0;
+  
+  for (int i = 0; i < num; i++) {
+    int tnote;
+    hash_t name;
+    type_t type;
+    
+    if (!frag_get_int(in, &tnote) || !frag_get_str(in, &name))
+      return 0;
+    
+    switch (tnote) {
+    case NOTE_STRUCT:
+      if (!read_struct(in, name))
+        return 0;
+      break;
+    case NOTE_GLOBAL:
+      if (!get_type(in, &type) || !type.spec)
+        return 0;
+      insert_decl(scope_global, type.spec, type.dcltr, NULL, name, 0);
+      break;
+    case NOTE_PROTO:
+    case NOTE_EXTERN:
+    case NOTE_FUNC:
+      if (!read_func(in, tnote, name))
+        return 0;
+      break;
+    default:
+      return 0;
+    }
+    
+    pch_note(tnote, name);
+  }
+  
+  return 1;
+}
+
+void pch_write(FILE *out, pch_t *pch)
+{
+  frag_put_int(out, pch->note_hi - pch->note_lo);
+  
+  for (int i = pch->note_lo; i < pch->note_hi; i++) {
+    frag_put_int(out, note[i].tnote);
+    frag_put_str(out, note[i].name);
+    
+    switch (note[i].tnote) {
+    case NOTE_STRUCT:
+      write_struct(out, map_get(scope_struct, note[i].name));
+      break;
+    case NOTE_GLOBAL:
+      put_type(out, &((decl_t*) map_get(scope_global->map, note[i].name))->type);
+      break;
+    default:
+      write_func(out, note[i].tnote, map_get(scope_func, note[i].name));
+      break;
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef PCH_H
+#define PCH_H
+
+#include "parse.h"
+#include <stdio.h>
+
+typedef struct pch_s pch_t;
+typedef struct note_s note_t;
+typedef enum tnote_e tnote_t;
+
+enum tnote_e {
+  NOTE_PROTO,
+  NOTE_EXTERN,
+  NOTE_FUNC,
+  NOTE_STRUCT,
+  NOTE_GLOBAL
+};
+
+struct note_s {
+  tnote_t tnote;
+  hash_t name;
+};
+
+struct pch_s {
+  char *fname;
+  unsigned long key;
+  int depth;
+  int note_lo;
+  int note_hi;
+  hash_t *file;
+  int num_file;
+  pch_t *next;
+};
+
+extern int pch_enabled;
+
+void pch_init(int f_read);
+void pch_note(tnote_t tnote, hash_t name);
+int pch_include(char *fname);
+void pch_pop();
+func_t *pch_func();
+int pch_pending();
+void pch_flush(unit_t *unit);
+int pch_read(FILE *in);
+void pch_write(FILE *out, pch_t *pch);
+
+#endif
@@ -2,22 +2,38 @@
 
 #include <stdlib.h>
 
+static int par_depth = 0;
+static expr_t *par_var = NULL;
+
 stmt_t *make_stmt()
 {
-  return malloc(sizeof(stmt_t));
+  stmt_t *stmt = malloc(sizeof(stmt_t));
+  stmt->file = 0;
+  stmt->line = 0;
+  return stmt;
 }
 
 stmt_t *statement()
 {
+  hash_t file = hash_value(lex.fid->fname);
+  int line = lex.fid->line_no;
+  
   stmt_t *stmt = NULL;
   if ((stmt = if_statement())
   || (stmt = while_statement())
+  || (stmt = par_statement())
   || (stmt = compound_statement())
   || (stmt = return_statement())
   || (stmt = inline_asm_statement())
   || (stmt = declaration_statement())
-  || (stmt = expression_statement()))
+  || (stmt = expression_statement())) {
+    if (!stmt->line) {
+      stmt->file = file;
+      stmt->line = line;
+    }
+    
     return stmt;
+  }
   
   return NULL;
 }
@@ -58,6 +74,9 @@ stmt_t *compound_statement()
   
   match('}');
   
+  if (!body)
+    return make_expr_stmt(NULL);
+  
   return body;
 }
 
@@ -68,6 +87,9 @@ stmt_t *return_statement()
   
   match(TK_RETURN);
   
+  if (par_depth)
+    token_error("cannot return from the body of a par while");
+  
   expr_t *value = NULL;
   
   if (lex.token != ';')
@@ -122,6 +144,8 @@ stmt_t *while_statement()
   if (lex.token != TK_WHILE)
     return NULL;
   
+  loop_t *loop = par_depth ? NULL : autopar_begin();
+  
   match(TK_WHILE);
   
   match('(');
@@ -132,8 +156,76 @@ stmt_t *while_statement()
     token_error("expected expression");
   
   stmt_t *body = statement();
+  stmt_t *stmt = make_while_stmt(cond, body);
+  
+  if (loop)
+    autopar_end(loop, stmt);
+  
+  return stmt;
+}
+
+int is_par_var(expr_t *expr)
+{
+  return expr
+  && expr->texpr == EXPR_LOAD
+  && expr->addr.base->texpr == EXPR_CONST
+  && expr->type.spec->tspec == TY_I32
+  && !expr->type.dcltr;
+}
+
+int is_par_counter(expr_t *expr)
+{
+  return par_var
+  && expr->texpr == EXPR_LOAD
+  && expr->addr.taddr == par_var->addr.taddr
+  && expr->addr.base->texpr == EXPR_CONST
+  && expr->addr.base->num == par_var->addr.base->num;
+}
+
+stmt_t *par_statement()
+{
+  if (lex.token != TK_PAR)
+    return NULL;
+  
+  match(TK_PAR);
+  
+  if (par_depth)
+    token_error("par while cannot be nested");
+  
+  match(TK_WHILE);
+  
+  match('(');
+  expr_t *cond = expression();
+  match(')');
+  
+  if (!cond
+  || cond->texpr != EXPR_BINOP
+  || cond->binop.op != OPERATOR_LSS
+  || !is_par_var(cond->binop.lhs))
+    token_error("expected condition of the form 'i < n' with i an i32 variable");
+  
+  expr_t *reduce = NULL;
+  
+  if (lex.token == TK_REDUCE) {
+    match(TK_REDUCE);
+    match('(');
+    reduce = expression();
+    match(')');
+    
+    if (!is_par_var(reduce))
+      token_error("expected i32 variable to reduce");
+  }
+  
+  current_scope->size = (current_scope->size + 3) & ~3;
+  int local_lo = current_scope->size;
+  
+  par_depth++;
+  par_var = cond->binop.lhs;
+  stmt_t *body = statement();
+  par_var = NULL;
+  par_depth--;
   
-  return make_while_stmt(cond, body);
+  return make_par_stmt(cond->binop.lhs, cond->binop.rhs, reduce, body, local_lo, current_scope->size);
 }
 
 stmt_t *declaration_statement()
@@ -186,6 +278,22 @@ stmt_t *make_while_stmt(expr_t *cond, stmt_t *body)
   stmt->tstmt = STMT_WHILE;
   stmt->while_stmt.cond = cond;
   stmt->while_stmt.body = body;
+  stmt->while_stmt.loop = NULL;
+  stmt->next = NULL;
+  return stmt;
+}
+
+stmt_t *make_par_stmt(expr_t *var, expr_t *limit, expr_t *reduce, stmt_t *body, int local_lo, int local_hi)
+{
+  stmt_t *stmt = make_stmt();
+  stmt->tstmt = STMT_PAR;
+  stmt->par_stmt.var = var;
+  stmt->par_stmt.limit = limit;
+  stmt->par_stmt.reduce = reduce;
+  stmt->par_stmt.body = body;
+  stmt->par_stmt.taddr = current_scope->taddr;
+  stmt->par_stmt.local_lo = local_lo;
+  stmt->par_stmt.local_hi = local_hi;
   stmt->next = NULL;
   return stmt;
 }
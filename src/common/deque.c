@@ -0,0 +1,76 @@
+#include "deque.h"
+
+#include <stdlib.h>
+
+static darray_t *make_darray(long size, darray_t *prev)
+{
+  darray_t *array = malloc(sizeof(darray_t) + size * sizeof(void*));
+  array->size = size;
+  array->prev = prev;
+  return array;
+}
+
+void deque_init(deque_t *deque, long size)
+{
+  atomic_init(&deque->top, 0);
+  atomic_init(&deque->bottom, 0);
+  atomic_init(&deque->array, make_darray(size, NULL));
+}
+
+void deque_free(deque_t *deque)
+{
+  darray_t *array = atomic_load(&deque->array);
+  
+  while (array) {
+    darray_t *prev = array->prev;
+    free(array);
+    array = prev;
+  }
+}
+
+static darray_t *grow(deque_t *deque, darray_t *array, long top, long bottom)
+{
+  darray_t *next = make_darray(array->size * 2, array);
+  
+  for (long i = top; i < bottom; i++) {
+    void *item = atomic_load_explicit(&array->buf[i % array->size], memory_order_relaxed);
+    atomic_store_explicit(&next->buf[i % next->size], item, memory_order_relaxed);
+  }
+  
+  atomic_store_explicit(&deque->array, next, memory_order_release);
+  
+  return next;
+}
+
+void deque_push(deque_t *deque, void *item)
+{
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  darray_t *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+  
+  if (bottom - top > array->size - 1)
+    array = grow(deque, array, top, bottom);
+  
+  atomic_store_explicit(&array->buf[bottom % array->size], item, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+void *deque_steal(deque_t *deque)
+{
+  long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  
+  if (top >= bottom)
+    return NULL;
+  
+  darray_t *array = atomic_load_explicit(&deque->array, memory_order_acquire);
+  void *item = atomic_load_explicit(&array->buf[top % array->size], memory_order_relaxed);
+  
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+    memory_order_seq_cst, memory_order_relaxed))
+    return DEQUE_ABORT;
+  
+  return item;
+}
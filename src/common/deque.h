@@ -0,0 +1,29 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include <stdatomic.h>
+
+#define CACHE_LINE 64
+#define DEQUE_ABORT ((void*) -1)
+
+typedef struct deque_s deque_t;
+typedef struct darray_s darray_t;
+
+struct darray_s {
+  long size;
+  darray_t *prev;
+  _Atomic(void*) buf[];
+};
+
+struct deque_s {
+  _Alignas(CACHE_LINE) atomic_long top;
+  _Alignas(CACHE_LINE) atomic_long bottom;
+  _Alignas(CACHE_LINE) _Atomic(darray_t*) array;
+};
+
+void deque_init(deque_t *deque, long size);
+void deque_free(deque_t *deque);
+void deque_push(deque_t *deque, void *item);
+void *deque_steal(deque_t *deque);
+
+#endif
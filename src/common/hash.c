@@ -15,7 +15,7 @@ static map_t str_map;
 
 void hash_init()
 {
-  str_size = 1024;
+  str_size = MAX_STR;
   str_buf = malloc(str_size);
   str_ptr = str_buf;
   str_map = make_map();
@@ -26,8 +26,9 @@ void *str_alloc(char *value)
   int len = strlen(value);
   
   if (str_ptr + len >= &str_buf[str_size]) {
-    printf("str_alloc(): ran out of memory\n");
-    exit(-1);
+    str_size = len + 1 > MAX_STR ? len + 1 : MAX_STR;
+    str_buf = malloc(str_size);
+    str_ptr = str_buf;
   }
   
   char *ptr = str_ptr;
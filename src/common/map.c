@@ -4,7 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_ENTRIES 1021
+#define MAX_ENTRIES 65521
 
 typedef struct entry_s entry_t;
 
@@ -12,15 +12,26 @@ struct entry_s {
   void *value;
   map_t map;
   entry_t *next;
+  entry_t *prev;
+  entry_t *owned;
   hash_t key;
 };
 
 static int map_id = 0;
+static int max_map = 0;
 
 static entry_t *entry_dict[MAX_ENTRIES];
+static entry_t **map_owned;
 
 map_t make_map()
 {
+  if (map_id >= max_map) {
+    max_map = max_map ? max_map * 2 : 64;
+    map_owned = realloc(map_owned, max_map * sizeof(entry_t*));
+  }
+  
+  map_owned[map_id] = NULL;
+  
   return map_id++;
 }
 
@@ -31,51 +42,54 @@ entry_t *new_entry(int map, hash_t key, void *value)
   entry->key = key;
   entry->value = value;
   entry->next = NULL;
+  entry->prev = NULL;
+  entry->owned = NULL;
   return entry;
 }
 
 void map_flush(map_t map)
 {
-  entry_t *prev_entry = NULL;
-  for (int i = 0; i < MAX_ENTRIES; i++) {
-    entry_t *entry = entry_dict[i];
+  entry_t *entry = map_owned[map];
+  
+  while (entry) {
+    entry_t *owned = entry->owned;
     
-    if (entry) {
-      while (entry) {
-        if (entry->map == map) {
-          if (prev_entry)
-            prev_entry->next = entry->next;
-          else
-            entry_dict[i] = entry->next;
-          
-          free(entry);
-        }
-        
-        prev_entry = entry;
-        entry = entry->next;
-      }
-    }
+    if (entry->prev)
+      entry->prev->next = entry->next;
+    else
+      entry_dict[entry->key % MAX_ENTRIES] = entry->next;
+    
+    if (entry->next)
+      entry->next->prev = entry->prev;
+    
+    free(entry);
+    
+    entry = owned;
   }
+  
+  map_owned[map] = NULL;
 }
 
 int map_put(map_t map, hash_t key, void *value)
 {
   int id = key % MAX_ENTRIES;
   
-  entry_t *entry = entry_dict[id];
-  
-  if (entry) {
-    while (entry->next) {
-      if (entry->key == key && entry->map == map)
-        return 0;
-      entry = entry->next;
-    }
-    
-    entry->next = new_entry(map, key, value);
-  } else {
-    entry_dict[id] = new_entry(map, key, value);
+  for (entry_t *entry = entry_dict[id]; entry; entry = entry->next) {
+    if (entry->key == key && entry->map == map)
+      return 0;
   }
   
+  entry_t *entry = new_entry(map, key, value);
+  entry->next = entry_dict[id];
+  
+  if (entry->next)
+    entry->next->prev = entry;
+  
+  entry_dict[id] = entry;
+  
+  entry->owned = map_owned[map];
+  map_owned[map] = entry;
+  
   return 1;
 }
 
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+
+#include "../common/hash.h"
+#include "../vm/bin.h"
+
+int main(int argc, char **argv)
+{
+  extern char *optarg;
+  extern int optind;
+  
+  int c, err = 0;
+  int flag_compact = 0;
+  char *out_file = NULL;
+  
+  static char usage[] = "usage: %s [-z] -o out object...\n";
+  
+  while ((c = getopt(argc, argv, "zo:")) != -1) {
+    switch (c) {
+    case 'z':
+      flag_compact = 1;
+      break;
+    case 'o':
+      out_file = optarg;
+      break;
+    case '?':
+      err = 1;
+      break;
+    }
+  }
+  
+  if (err || !out_file || optind >= argc) {
+    fprintf(stderr, usage, argv[0]);
+    exit(1);
+  }
+  
+  hash_init();
+  
+  int num_obj = argc - optind;
+  char **name = &argv[optind];
+  bin_t **obj = malloc(num_obj * sizeof(bin_t*));
+  
+  for (int i = 0; i < num_obj; i++) {
+    obj[i] = bin_map(name[i], 0);
+    
+    if (!obj[i]) {
+      fprintf(stderr, "%s: could not load %s\n", argv[0], name[i]);
+      exit(1);
+    }
+    
+    if (!obj[i]->f_object) {
+      fprintf(stderr, "%s: %s is not an object file\n", argv[0], name[i]);
+      exit(1);
+    }
+  }
+  
+  bin_t *bin = bin_link(obj, name, num_obj);
+  if (!bin)
+    exit(1);
+  
+  FILE *out = fopen(out_file, "wb");
+  if (!out) {
+    fprintf(stderr, "%s: could not open %s\n", argv[0], out_file);
+    exit(1);
+  }
+  
+  bin_write(bin, out, flag_compact);
+  fclose(out);
+  
+  return 0;
+}
@@ -2,12 +2,139 @@
 #include <stdlib.h>
 
 #include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "common/error.h"
 #include "cc/lex.h"
 #include "cc/gen.h"
 #include "cc/parse.h"
+#include "cc/frag.h"
+#include "cc/pch.h"
 #include "vm/vm.h"
+#include "vm/sched.h"
+#include "vm/pool.h"
+#include "cache.h"
+#include <limits.h>
+
+static bin_t *compile(char *prog, char *fname, int flag_par, int flag_object)
+{
+  FILE *in = fopen(fname, "rb");
+  if (!in) {
+    fprintf(stderr, "%s: could not open %s\n", prog, fname);
+    exit(1);
+  }
+  
+  lex_init();
+  parse_init(flag_par);
+  
+  lexify(in, fname);
+  
+  unit_t *unit = translation_unit();
+  
+  bin_t *bin = gen(unit, flag_object);
+  
+  if (pch_enabled)
+    pch_flush(unit);
+  
+  fclose(in);
+  
+  return bin;
+}
+
+static bin_t *load_bin(char *prog, char *fname)
+{
+  bin_t *bin = bin_map(fname, 0);
+  if (!bin) {
+    fprintf(stderr, "%s: could not load %s\n", prog, fname);
+    exit(1);
+  }
+  
+  if (bin->f_object) {
+    fprintf(stderr, "%s: %s is an object file, link it with cirno-ld first\n", prog, fname);
+    exit(1);
+  }
+  
+  return bin;
+}
+
+static void save_bin(char *prog, char *fname, bin_t *bin, int f_compact)
+{
+  FILE *out = fopen(fname, "wb");
+  if (!out) {
+    fprintf(stderr, "%s: could not open %s\n", prog, fname);
+    exit(1);
+  }
+  
+  bin_write(bin, out, f_compact);
+  fclose(out);
+}
+
+static void save_bundle(char *prog, char *fname, bin_t *bin, int f_compact)
+{
+  char path[PATH_MAX];
+  
+  int len = readlink("/proc/self/exe", path, sizeof(path) - 16);
+  if (len < 0) {
+    fprintf(stderr, "%s: could not find own executable\n", prog);
+    exit(1);
+  }
+  
+  path[len] = '\0';
+  strcpy(strrchr(path, '/') + 1, "cirno-rt");
+  
+  FILE *rt = fopen(path, "rb");
+  if (!rt) {
+    fprintf(stderr, "%s: could not open %s, build it with make cirno-rt\n", prog, path);
+    exit(1);
+  }
+  
+  FILE *out = fopen(fname, "wb");
+  if (!out) {
+    fprintf(stderr, "%s: could not open %s\n", prog, fname);
+    exit(1);
+  }
+  
+  bin_bundle(bin, rt, out, f_compact);
+  
+  fclose(rt);
+  fclose(out);
+  
+  chmod(fname, 0755);
+}
+
+static bin_t *load(char *prog, char *fname, int flag_bin, int flag_par, int flag_force)
+{
+  if (flag_bin)
+    return load_bin(prog, fname);
+  
+  cache_key_t key = cache_key(fname, flag_par);
+  
+  if (key && !flag_force) {
+    bin_t *bin = cache_read(fname, key);
+    if (bin)
+      return bin;
+  }
+  
+  if (key && !flag_par) {
+    frag_init();
+    pch_init(!flag_force);
+    
+    if (!flag_force)
+      cache_read_frag(fname);
+  }
+  
+  bin_t *bin = compile(prog, fname, flag_par, 0);
+  
+  if (key)
+    cache_write(fname, key, bin);
+  
+  if (frag_enabled)
+    cache_write_frag(fname);
+  
+  return bin;
+}
 
 int main(int argc, char **argv)
 {
@@ -16,14 +143,69 @@ int main(int argc, char **argv)
   
   int c, err = 0;
   int flag_dump = 0;
+  int flag_line = 0;
+  int flag_par = 0;
+  int flag_bin = 0;
+  int flag_force = 0;
+  int flag_compact = 0;
+  int flag_object = 0;
+  int flag_bundle = 0;
+  char *out_file = NULL;
+  int num_copy = 1;
+  int num_thread = -1;
+  int fuel = -1;
+  
+  static char usage[] = "usage: %s [-bcdDFlpz] [--bundle] [-n count] [-j threads] [-f fuel] [-o out] file...\n";
   
-  static char usage[] = "usage: %s [-dD] file\n";
+  static struct option long_opts[] = {
+    { "bundle", no_argument, NULL, 'B' },
+    { 0 }
+  };
   
-  while ((c = getopt(argc, argv, "dD")) != -1) {
+  while ((c = getopt_long(argc, argv, "bcdDFlpzf:j:n:o:", long_opts, NULL)) != -1) {
     switch (c) {
+    case 'B':
+      flag_bundle = 1;
+      break;
     case 'D':
       flag_dump = 1;
       break;
+    case 'l':
+      flag_line = 1;
+      break;
+    case 'p':
+      flag_par = 1;
+      break;
+    case 'b':
+      flag_bin = 1;
+      break;
+    case 'c':
+      flag_object = 1;
+      break;
+    case 'F':
+      flag_force = 1;
+      break;
+    case 'z':
+      flag_compact = 1;
+      break;
+    case 'o':
+      out_file = optarg;
+      break;
+    case 'f':
+      fuel = atoi(optarg);
+      if (fuel < 0)
+        err = 1;
+      break;
+    case 'j':
+      num_thread = atoi(optarg);
+      if (num_thread < 0)
+        err = 1;
+      break;
+    case 'n':
+      num_copy = atoi(optarg);
+      if (num_copy < 1)
+        err = 1;
+      break;
     case '?':
       err = 1;
       break;
@@ -39,33 +221,111 @@ int main(int argc, char **argv)
     exit(1);
   }
   
-  char *fname = argv[optind];
+  hash_init();
   
-  FILE *in = fopen(fname, "rb");
-  if (!in) {
-    fprintf(stderr, "%s: could not open %s\n", argv[0], fname);
-    exit(1);
+  int num_file = argc - optind;
+  
+  if (flag_object) {
+    if (num_file != 1 || !out_file || flag_bin) {
+      fprintf(stderr, "%s: -c takes a single source file and -o\n", argv[0]);
+      exit(1);
+    }
+    
+    save_bin(argv[0], out_file, compile(argv[0], argv[optind], flag_par, 1), flag_compact);
+    
+    return 0;
   }
   
-  lex_init();
-  hash_init();
-  parse_init();
+  if (flag_bundle) {
+    if (num_file != 1 || !out_file) {
+      fprintf(stderr, "%s: --bundle takes a single input file and -o\n", argv[0]);
+      exit(1);
+    }
+    
+    save_bundle(argv[0], out_file, load(argv[0], argv[optind], flag_bin, flag_par, flag_force), flag_compact);
+    
+    return 0;
+  }
   
-  lexify(in, fname);
+  if (out_file) {
+    if (num_file != 1) {
+      fprintf(stderr, "%s: -o takes a single input file\n", argv[0]);
+      exit(1);
+    }
+    
+    save_bin(argv[0], out_file, load(argv[0], argv[optind], flag_bin, flag_par, flag_force), flag_compact);
+    
+    return 0;
+  }
   
-  unit_t *unit = translation_unit();
+  if (num_file == 1 && num_copy == 1 && num_thread == -1) {
+    bin_t *bin = load(argv[0], argv[optind], flag_bin, flag_par, flag_force);
+    
+    if (flag_dump) {
+      bin_dump(bin);
+      gen_dump();
+    }
+    
+    vm_t *vm = make_vm();
+    vm->proc->io.f_line = flag_line;
+    vm->proc->budget = fuel;
+    vm_load(vm, bin);
+    
+    if (flag_dump)
+      verify_dump(&vm->proc->verify);
+    
+    fflush(stdout);
+    
+    vm_status_t status;
+    while ((status = vm_exec(vm, INT_MAX)) != VM_EXIT && status != VM_FUEL);
+    
+    if (flag_dump)
+      heap_dump(&vm->proc->heap);
+    
+    return status == VM_FUEL;
+  }
   
-  bin_t *bin = gen(unit);
+  sched_t *sched = NULL;
+  pool_t *pool = NULL;
   
-  if (flag_dump)
-    bin_dump(bin);
+  if (num_thread == -1)
+    sched = make_sched(SCHED_SLICE);
+  else
+    pool = make_pool(num_thread, POOL_SLICE);
   
-  vm_t *vm = make_vm();
-  vm_load(vm, bin);
+  for (int i = optind; i < argc; i++) {
+    bin_t *bin = load(argv[0], argv[i], flag_bin, flag_par, flag_force);
+    
+    if (flag_dump) {
+      bin_dump(bin);
+      gen_dump();
+    }
+    
+    for (int j = 0; j < num_copy; j++) {
+      vm_t *vm = make_vm();
+      vm->proc->io.f_line = flag_line;
+      vm->proc->budget = fuel;
+      vm_load(vm, bin);
+      
+      if (pool)
+        pool_add(pool, vm);
+      else
+        sched_add(sched, vm);
+    }
+  }
   
-  vm_exec(vm);
+  fflush(stdout);
   
-  fclose(in);
+  if (pool) {
+    pool_run(pool);
+    
+    if (flag_dump)
+      pool_dump(pool);
+    
+    free_pool(pool);
+  } else {
+    sched_run(sched);
+  }
   
   return 0;
 }
@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "../common/hash.h"
+#include "../vm/bin.h"
+#include "../vm/vm.h"
+
+int main(int argc, char **argv)
+{
+  hash_init();
+  
+  bin_t *bin = bin_map_bundle("/proc/self/exe");
+  if (!bin) {
+    fprintf(stderr, "%s: no program bundled, make one with cirno --bundle\n", argc > 0 ? argv[0] : "cirno-rt");
+    exit(1);
+  }
+  
+  vm_t *vm = make_vm();
+  vm_load(vm, bin);
+  
+  while (vm_exec(vm, INT_MAX) != VM_EXIT);
+  
+  return 0;
+}
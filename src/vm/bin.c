@@ -1,25 +1,85 @@
 #include "bin.h"
 
+#include "../common/map.h"
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-typedef enum tlump_e tlump_t;
-typedef struct lump_s lump_t;
+#define BIN_MAGIC "9cbn"
+#define BIN_VERSION 1
+
+#define BUNDLE_MAGIC "9cbundle"
+#define BUNDLE_ALIGN 4096
+
+#define FNV32_BASIS 2166136261u
+#define FNV32_PRIME 16777619u
+
+typedef enum tsect_e tsect_t;
+typedef struct sect_s sect_t;
 typedef struct header_s header_t;
+typedef struct fsym_s fsym_t;
+typedef struct fline_s fline_t;
+typedef struct freloc_s freloc_t;
+typedef struct image_s image_t;
+typedef struct trailer_s trailer_t;
 
-enum tlump_e {
-  LUMP_DATA,
-  LUMP_INSTR,
-  MAX_LUMP
+enum tsect_e {
+  SECT_DATA,
+  SECT_INSTR,
+  SECT_CODE,
+  SECT_SYMBOL,
+  SECT_LINE,
+  SECT_STRING,
+  SECT_EXPORT,
+  SECT_RELOC,
+  MAX_SECT
 };
 
-struct lump_s {
+struct sect_s {
+  int type;
   int fileofs;
   int filelen;
 };
 
 struct header_s {
+  char magic[4];
+  int version;
+  unsigned int checksum;
   int bss_size;
-  lump_t lumps[MAX_LUMP];
+  int num_sect;
+};
+
+struct fsym_s {
+  int pos;
+  int name;
+};
+
+struct fline_s {
+  int pos;
+  int file;
+  int line;
+};
+
+struct freloc_s {
+  int type;
+  int pos;
+  int name;
+};
+
+struct image_s {
+  char *buf;
+  int size;
+  int max;
+  map_t map;
+};
+
+struct trailer_s {
+  long base;
+  long size;
+  char magic[8];
 };
 
 char *instr_tbl[] = {
@@ -54,7 +114,13 @@ char *instr_tbl[] = {
   "setge",
   "sx8_32",
   "sx32_8",
-  "int"
+  "int",
+  "ncall",
+  "pop",
+  "xchg",
+  "cas",
+  "fadd",
+  "fence"
 };
 
 int num_instr_tbl = sizeof(instr_tbl) / sizeof(char *);
@@ -67,80 +133,562 @@ bin_t *make_bin(instr_t *instr, int num_instr, void *data, int data_size, int bs
   bin->data = data;
   bin->data_size = data_size;
   bin->bss_size = bss_size;
+  bin->sym = NULL;
+  bin->num_sym = 0;
+  bin->line = NULL;
+  bin->num_line = 0;
+  bin->f_object = 0;
+  bin->export = NULL;
+  bin->num_export = 0;
+  bin->reloc = NULL;
+  bin->num_reloc = 0;
   return bin;
 }
 
+int instr_size(instr_t instr)
+{
+  switch (instr) {
+  case PUSH:
+  case ENTER:
+  case CALL:
+  case JMP:
+  case JE:
+  case JNE:
+  case JL:
+  case JG:
+  case JLE:
+  case JGE:
+  case INT:
+  case NCALL:
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+sym_t *bin_find_sym(bin_t *bin, int pos)
+{
+  sym_t *found = NULL;
+  
+  for (int i = 0; i < bin->num_sym; i++) {
+    if (bin->sym[i].pos <= pos && (!found || bin->sym[i].pos >= found->pos))
+      found = &bin->sym[i];
+  }
+  
+  return found;
+}
+
+line_t *bin_find_line(bin_t *bin, int pos)
+{
+  line_t *found = NULL;
+  
+  for (int i = 0; i < bin->num_line; i++) {
+    if (bin->line[i].pos <= pos && (!found || bin->line[i].pos >= found->pos))
+      found = &bin->line[i];
+  }
+  
+  return found;
+}
+
+void bin_where(bin_t *bin, int pos, FILE *out)
+{
+  fprintf(out, "%i", pos);
+  
+  sym_t *sym = bin_find_sym(bin, pos);
+  if (sym)
+    fprintf(out, " in %s", hash_get(sym->name));
+  
+  line_t *line = bin_find_line(bin, pos);
+  if (line)
+    fprintf(out, " (%s:%i)", hash_get(line->file), line->line);
+}
+
 void bin_dump(bin_t *bin)
 {
   int i = 0;
   while (i < bin->num_instr) {
-    switch (bin->instr[i]) {
-    case PUSH:
-    case ENTER:
-    case CALL:
-    case JMP:
-    case JE:
-    case JNE:
-    case JL:
-    case JG:
-    case JLE:
-    case JGE:
-    case INT:
+    for (int j = 0; j < bin->num_sym; j++) {
+      if (bin->sym[j].pos == i)
+        printf("%s:\n", hash_get(bin->sym[j].name));
+    }
+    
+    if (instr_size(bin->instr[i]) == 2)
       printf("%03i %s %i\n", i, instr_tbl[bin->instr[i]], bin->instr[i + 1]);
-      i += 2;
-      break;
-    default:
+    else
       printf("%03i %s\n", i, instr_tbl[bin->instr[i]]);
-      i += 1;
-      break;
+    
+    i += instr_size(bin->instr[i]);
+  }
+}
+
+static int is_relative(instr_t instr)
+{
+  switch (instr) {
+  case CALL:
+  case JMP:
+  case JE:
+  case JNE:
+  case JL:
+  case JG:
+  case JLE:
+  case JGE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static int put_varint(unsigned char *p, int i32)
+{
+  unsigned int n = ((unsigned int) i32 << 1) ^ (i32 >> 31);
+  int len = 0;
+  
+  while (n >= 0x80) {
+    p[len++] = n | 0x80;
+    n >>= 7;
+  }
+  
+  p[len++] = n;
+  
+  return len;
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end, int *i32)
+{
+  unsigned int n = 0;
+  
+  for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+    unsigned char c = *(*p)++;
+    n |= (unsigned int) (c & 0x7f) << shift;
+    
+    if (!(c & 0x80)) {
+      *i32 = (n >> 1) ^ -(n & 1);
+      return 1;
+    }
+  }
+  
+  return 0;
+}
+
+unsigned char *bin_encode_code(instr_t *code, int num_instr, int *size)
+{
+  unsigned char *buf = malloc(5 + num_instr * 5);
+  int len = put_varint(buf, num_instr);
+  
+  for (int i = 0; i < num_instr; i += instr_size(code[i])) {
+    instr_t instr = code[i];
+    buf[len++] = instr;
+    
+    if (instr_size(instr) == 2) {
+      int operand = code[i + 1];
+      
+      if (is_relative(instr))
+        operand -= i;
+      
+      len += put_varint(&buf[len], operand);
     }
   }
+  
+  *size = len;
+  
+  return buf;
+}
+
+instr_t *bin_decode_code(const unsigned char *p, int size, int *num_instr)
+{
+  const unsigned char *end = p + size;
+  
+  int n;
+  if (!get_varint(&p, end, &n) || n < 0 || n > size * 2)
+    return NULL;
+  
+  instr_t *instr = malloc((n + 1) * sizeof(instr_t));
+  
+  int i = 0;
+  while (i < n) {
+    if (p == end || *p >= num_instr_tbl)
+      goto fail;
+    
+    instr[i] = *p++;
+    
+    if (instr_size(instr[i]) == 2) {
+      int operand;
+      if (i + 1 == n || !get_varint(&p, end, &operand))
+        goto fail;
+      
+      if (is_relative(instr[i]))
+        operand += i;
+      
+      instr[i + 1] = operand;
+    }
+    
+    i += instr_size(instr[i]);
+  }
+  
+  if (p != end)
+    goto fail;
+  
+  *num_instr = n;
+  
+  return instr;
+  
+fail:
+  free(instr);
+  return NULL;
+}
+
+static unsigned int checksum(const char *buf, long len)
+{
+  unsigned int sum = FNV32_BASIS;
+  
+  for (long i = 0; i < len; i++) {
+    sum ^= (unsigned char) buf[i];
+    sum *= FNV32_PRIME;
+  }
+  
+  return sum;
 }
 
-void write_lump(FILE *out, header_t *header, void *src, int size, tlump_t tlump)
+static int image_put(image_t *image, const void *src, int len)
 {
-  header->lumps[tlump].fileofs = ftell(out);
-  header->lumps[tlump].filelen = size;
-  fwrite(src, 1, size, out);
+  if (image->size + len > image->max) {
+    image->max = (image->size + len) * 2;
+    image->buf = realloc(image->buf, image->max);
+  }
+  
+  int ofs = image->size;
+  
+  if (src)
+    memcpy(&image->buf[ofs], src, len);
+  else
+    memset(&image->buf[ofs], 0, len);
+  
+  image->size += len;
+  
+  return ofs;
+}
+
+static void image_sect(image_t *image, sect_t *sect, tsect_t type, const void *src, int len)
+{
+  static const char pad[4];
+  image_put(image, pad, -image->size & 3);
+  
+  sect->type = type;
+  sect->fileofs = image_put(image, src, len);
+  sect->filelen = len;
+}
+
+static int image_str(image_t *strtab, hash_t str)
+{
+  long ofs = (long) map_get(strtab->map, str);
+  if (ofs)
+    return ofs - 1;
+  
+  ofs = image_put(strtab, hash_get(str), strlen(hash_get(str)) + 1);
+  map_put(strtab->map, str, (void*) (ofs + 1));
+  
+  return ofs;
 }
 
-void bin_write(bin_t *bin, FILE *out)
+static fsym_t *pack_sym(image_t *strtab, sym_t *sym, int num_sym)
 {
-  fseek(out, sizeof(header_t), SEEK_SET);
+  fsym_t *fsym = malloc((num_sym + 1) * sizeof(fsym_t));
+  
+  for (int i = 0; i < num_sym; i++) {
+    fsym[i].pos = sym[i].pos;
+    fsym[i].name = image_str(strtab, sym[i].name);
+  }
+  
+  return fsym;
+}
+
+void bin_write(bin_t *bin, FILE *out, int f_compact)
+{
+  image_t image = { 0 };
+  image_t strtab = { 0 };
+  strtab.map = make_map();
+  
+  fsym_t *fsym = pack_sym(&strtab, bin->sym, bin->num_sym);
+  fsym_t *fexport = pack_sym(&strtab, bin->export, bin->num_export);
+  
+  fline_t *fline = malloc((bin->num_line + 1) * sizeof(fline_t));
+  for (int i = 0; i < bin->num_line; i++) {
+    fline[i].pos = bin->line[i].pos;
+    fline[i].file = image_str(&strtab, bin->line[i].file);
+    fline[i].line = bin->line[i].line;
+  }
+  
+  freloc_t *freloc = malloc((bin->num_reloc + 1) * sizeof(freloc_t));
+  for (int i = 0; i < bin->num_reloc; i++) {
+    freloc[i].type = bin->reloc[i].type;
+    freloc[i].pos = bin->reloc[i].pos;
+    freloc[i].name = bin->reloc[i].type == RELOC_SYM ? image_str(&strtab, bin->reloc[i].name) : -1;
+  }
+  
+  sect_t sect[MAX_SECT - 1];
+  int num_sect = bin->f_object ? 7 : 5;
+  
+  image_put(&image, NULL, sizeof(header_t) + num_sect * sizeof(sect_t));
+  
+  image_sect(&image, &sect[0], SECT_DATA, bin->data, bin->data_size);
+  
+  if (f_compact) {
+    int code_size;
+    unsigned char *code = bin_encode_code(bin->instr, bin->num_instr, &code_size);
+    image_sect(&image, &sect[1], SECT_CODE, code, code_size);
+    free(code);
+  } else {
+    image_sect(&image, &sect[1], SECT_INSTR, bin->instr, bin->num_instr * sizeof(instr_t));
+  }
+  
+  image_sect(&image, &sect[2], SECT_SYMBOL, fsym, bin->num_sym * sizeof(fsym_t));
+  image_sect(&image, &sect[3], SECT_LINE, fline, bin->num_line * sizeof(fline_t));
+  image_sect(&image, &sect[4], SECT_STRING, strtab.buf, strtab.size);
+  
+  if (bin->f_object) {
+    image_sect(&image, &sect[5], SECT_EXPORT, fexport, bin->num_export * sizeof(fsym_t));
+    image_sect(&image, &sect[6], SECT_RELOC, freloc, bin->num_reloc * sizeof(freloc_t));
+  }
+  
+  memcpy(&image.buf[sizeof(header_t)], sect, num_sect * sizeof(sect_t));
   
   header_t header;
+  memcpy(header.magic, BIN_MAGIC, sizeof(header.magic));
+  header.version = BIN_VERSION;
+  header.checksum = checksum(&image.buf[sizeof(header_t)], image.size - sizeof(header_t));
   header.bss_size = bin->bss_size;
+  header.num_sect = num_sect;
+  
+  memcpy(image.buf, &header, sizeof(header_t));
+  
+  fwrite(image.buf, 1, image.size, out);
+  
+  free(image.buf);
+  free(strtab.buf);
+  map_flush(strtab.map);
+  free(fsym);
+  free(fexport);
+  free(fline);
+  free(freloc);
+}
+
+static const char *sect_str(const char *strtab, int strtab_size, int ofs)
+{
+  if (ofs < 0 || ofs >= strtab_size || !memchr(&strtab[ofs], '\0', strtab_size - ofs))
+    return NULL;
+  
+  return &strtab[ofs];
+}
+
+static sym_t *unpack_sym(const char *strtab, int strtab_size, const char *part, int part_size, int *num_sym)
+{
+  fsym_t *fsym = (fsym_t*) part;
+  int num_fsym = part_size / sizeof(fsym_t);
+  
+  sym_t *sym = malloc((num_fsym + 1) * sizeof(sym_t));
+  *num_sym = 0;
   
-  write_lump(out, &header, bin->data, bin->data_size, LUMP_DATA);
-  write_lump(out, &header, bin->instr, bin->num_instr * sizeof(instr_t), LUMP_INSTR);
+  for (int i = 0; i < num_fsym; i++) {
+    const char *name = sect_str(strtab, strtab_size, fsym[i].name);
+    
+    if (name) {
+      sym[*num_sym].name = hash_value((char*) name);
+      sym[*num_sym].pos = fsym[i].pos;
+      (*num_sym)++;
+    }
+  }
   
-  fseek(out, 0, SEEK_SET);
-  fwrite(&header, 1, sizeof(header_t), out);
+  return sym;
 }
 
-void *copy_lump(FILE *in, header_t *header, int *size, tlump_t tlump)
+static bin_t *bin_parse(char *image, long size)
 {
-  fseek(in, header->lumps[tlump].fileofs, SEEK_SET);
+  if (size < (long) sizeof(header_t))
+    return NULL;
+  
+  header_t *header = (header_t*) image;
+  
+  if (memcmp(header->magic, BIN_MAGIC, sizeof(header->magic)) != 0
+  || header->version < 1 || header->version > BIN_VERSION
+  || header->num_sect < 0 || header->num_sect > (long) ((size - sizeof(header_t)) / sizeof(sect_t))
+  || header->checksum != checksum(&image[sizeof(header_t)], size - sizeof(header_t)))
+    return NULL;
+  
+  sect_t *sect = (sect_t*) &image[sizeof(header_t)];
+  
+  char *part[MAX_SECT] = { 0 };
+  int part_size[MAX_SECT] = { 0 };
+  
+  for (int i = 0; i < header->num_sect; i++) {
+    if (sect[i].fileofs < 0 || sect[i].filelen < 0 || sect[i].fileofs > size - sect[i].filelen)
+      return NULL;
+    
+    if (sect[i].type < 0 || sect[i].type >= MAX_SECT)
+      continue;
+    
+    part[sect[i].type] = &image[sect[i].fileofs];
+    part_size[sect[i].type] = sect[i].filelen;
+  }
+  
+  for (int i = SECT_SYMBOL; i < MAX_SECT; i++) {
+    if (part[i] && (part[i] - image) & 3)
+      return NULL;
+  }
+  
+  instr_t *instr = (instr_t*) part[SECT_INSTR];
+  int num_instr = part_size[SECT_INSTR] / sizeof(instr_t);
+  
+  if (part_size[SECT_CODE] > 0) {
+    instr = bin_decode_code((unsigned char*) part[SECT_CODE], part_size[SECT_CODE], &num_instr);
+    if (!instr)
+      return NULL;
+  } else if (!instr || (part[SECT_INSTR] - image) % sizeof(instr_t)) {
+    instr = malloc(part_size[SECT_INSTR] + 1);
+    memcpy(instr, part[SECT_INSTR], part_size[SECT_INSTR]);
+  }
+  
+  bin_t *bin = make_bin(instr, num_instr, part[SECT_DATA], part_size[SECT_DATA], header->bss_size);
+  
+  const char *strtab = part[SECT_STRING];
+  int strtab_size = part_size[SECT_STRING];
   
-  *size = header->lumps[tlump].filelen;
-  char *buffer = malloc(*size);
-  fread(buffer, 1, *size, in);
+  bin->sym = unpack_sym(strtab, strtab_size, part[SECT_SYMBOL], part_size[SECT_SYMBOL], &bin->num_sym);
   
-  return buffer;
+  fline_t *fline = (fline_t*) part[SECT_LINE];
+  int num_fline = part_size[SECT_LINE] / sizeof(fline_t);
+  
+  bin->line = malloc((num_fline + 1) * sizeof(line_t));
+  
+  for (int i = 0; i < num_fline; i++) {
+    const char *file = sect_str(strtab, strtab_size, fline[i].file);
+    
+    if (file) {
+      bin->line[bin->num_line].file = hash_value((char*) file);
+      bin->line[bin->num_line].line = fline[i].line;
+      bin->line[bin->num_line].pos = fline[i].pos;
+      bin->num_line++;
+    }
+  }
+  
+  if (!part[SECT_EXPORT] && !part[SECT_RELOC])
+    return bin;
+  
+  bin->f_object = 1;
+  bin->export = unpack_sym(strtab, strtab_size, part[SECT_EXPORT], part_size[SECT_EXPORT], &bin->num_export);
+  
+  freloc_t *freloc = (freloc_t*) part[SECT_RELOC];
+  int num_freloc = part_size[SECT_RELOC] / sizeof(freloc_t);
+  
+  bin->reloc = malloc((num_freloc + 1) * sizeof(reloc_t));
+  
+  for (int i = 0; i < num_freloc; i++) {
+    if (freloc[i].pos < 0 || freloc[i].pos >= num_instr || freloc[i].type < RELOC_CODE || freloc[i].type > RELOC_SYM)
+      return NULL;
+    
+    const char *name = NULL;
+    if (freloc[i].type == RELOC_SYM && !(name = sect_str(strtab, strtab_size, freloc[i].name)))
+      return NULL;
+    
+    bin->reloc[i].type = freloc[i].type;
+    bin->reloc[i].pos = freloc[i].pos;
+    bin->reloc[i].name = name ? hash_value((char*) name) : 0;
+  }
+  
+  bin->num_reloc = num_freloc;
+  
+  return bin;
 }
 
 bin_t *bin_read(FILE *in)
 {
-  header_t header;
-  fread(&header, 1, sizeof(header_t), in);
+  image_t image = { 0 };
+  char buf[4096];
+  
+  int len;
+  while ((len = fread(buf, 1, sizeof(buf), in)) > 0)
+    image_put(&image, buf, len);
+  
+  bin_t *bin = bin_parse(image.buf, image.size);
+  if (!bin)
+    free(image.buf);
+  
+  return bin;
+}
+
+static bin_t *map_range(int fd, long base, long size)
+{
+  long ofs = base & ~(sysconf(_SC_PAGESIZE) - 1);
+  long len = base - ofs + size;
+  
+  char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, ofs);
+  if (map == MAP_FAILED)
+    return NULL;
+  
+  bin_t *bin = bin_parse(&map[base - ofs], size);
+  if (!bin)
+    munmap(map, len);
+  
+  return bin;
+}
+
+bin_t *bin_map(const char *path, long base)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  
+  struct stat st;
+  bin_t *bin = NULL;
+  
+  if (fstat(fd, &st) == 0 && st.st_size > base)
+    bin = map_range(fd, base, st.st_size - base);
+  
+  close(fd);
+  
+  return bin;
+}
+
+bin_t *bin_map_bundle(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  
+  struct stat st;
+  trailer_t trailer;
+  bin_t *bin = NULL;
+  
+  if (fstat(fd, &st) == 0
+  && st.st_size >= (off_t) sizeof(trailer_t)
+  && pread(fd, &trailer, sizeof(trailer_t), st.st_size - sizeof(trailer_t)) == sizeof(trailer_t)
+  && memcmp(trailer.magic, BUNDLE_MAGIC, sizeof(trailer.magic)) == 0
+  && trailer.base >= 0 && trailer.size > 0
+  && trailer.size <= st.st_size - (off_t) sizeof(trailer_t) - trailer.base)
+    bin = map_range(fd, trailer.base, trailer.size);
+  
+  close(fd);
+  
+  return bin;
+}
+
+void bin_bundle(bin_t *bin, FILE *rt, FILE *out, int f_compact)
+{
+  char buf[4096];
+  
+  int len;
+  while ((len = fread(buf, 1, sizeof(buf), rt)) > 0)
+    fwrite(buf, 1, len, out);
+  
+  trailer_t trailer;
+  trailer.base = (ftell(out) + BUNDLE_ALIGN - 1) & ~(BUNDLE_ALIGN - 1);
   
-  int data_size;
-  void *data = copy_lump(in, &header, &data_size, LUMP_DATA);
+  while (ftell(out) < trailer.base)
+    fputc(0, out);
   
-  int instr_size;
-  instr_t *instr_buf  = copy_lump(in, &header, &instr_size, LUMP_INSTR);
+  bin_write(bin, out, f_compact);
   
-  int num_instr = instr_size / sizeof(instr_t);
+  trailer.size = ftell(out) - trailer.base;
+  memcpy(trailer.magic, BUNDLE_MAGIC, sizeof(trailer.magic));
   
-  return make_bin(instr_buf, num_instr, data, data_size, header.bss_size);
+  fwrite(&trailer, sizeof(trailer_t), 1, out);
 }
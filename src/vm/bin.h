@@ -7,6 +7,9 @@
 
 typedef struct bin_s bin_t;
 typedef struct sym_s sym_t;
+typedef struct line_s line_t;
+typedef enum treloc_e treloc_t;
+typedef struct reloc_s reloc_t;
 
 struct bin_s {
   instr_t *instr;
@@ -14,6 +17,15 @@ struct bin_s {
   void *data;
   int data_size;
   int bss_size;
+  sym_t *sym;
+  int num_sym;
+  line_t *line;
+  int num_line;
+  int f_object;
+  sym_t *export;
+  int num_export;
+  reloc_t *reloc;
+  int num_reloc;
 };
 
 struct sym_s {
@@ -21,12 +33,41 @@ struct sym_s {
   int pos;
 };
 
+struct line_s {
+  hash_t file;
+  int line;
+  int pos;
+};
+
+enum treloc_e {
+  RELOC_CODE,
+  RELOC_BSS,
+  RELOC_DATA,
+  RELOC_SYM
+};
+
+struct reloc_s {
+  treloc_t type;
+  int pos;
+  hash_t name;
+};
+
 extern char *instr_tbl[];
 extern int num_instr_tbl;
 
+int instr_size(instr_t instr);
 void bin_dump(bin_t *bin);
-void bin_write(bin_t *bin, FILE *out);
+sym_t *bin_find_sym(bin_t *bin, int pos);
+line_t *bin_find_line(bin_t *bin, int pos);
+void bin_where(bin_t *bin, int pos, FILE *out);
+void bin_write(bin_t *bin, FILE *out, int f_compact);
 bin_t *bin_read(FILE *in);
+bin_t *bin_map(const char *path, long base);
+bin_t *bin_map_bundle(const char *path);
+void bin_bundle(bin_t *bin, FILE *rt, FILE *out, int f_compact);
+unsigned char *bin_encode_code(instr_t *code, int num_instr, int *size);
+instr_t *bin_decode_code(const unsigned char *p, int size, int *num_instr);
+bin_t *bin_link(bin_t **obj, char **name, int num_obj);
 
 bin_t *make_bin(instr_t *instr, int num_instr, void *data, int data_size, int bss_size);
 
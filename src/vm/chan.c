@@ -0,0 +1,348 @@
+#include "chan.h"
+
+#include "../common/error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+
+static atomic_long dead_seq;
+
+static chan_t chan_dead = {
+  .mode = CHAN_MPMC,
+  .cap = 1,
+  .seq = &dead_seq,
+  .f_closed = 1
+};
+
+void chan_tbl_init(chan_tbl_t *tbl)
+{
+  pthread_mutex_init(&tbl->lock, NULL);
+  
+  for (int i = 0; i < MAX_CHAN; i++)
+    atomic_init(&tbl->chan[i], NULL);
+  
+  atomic_init(&tbl->free, NULL);
+  atomic_init(&tbl->gen, 0);
+}
+
+static void chan_release(chan_t *chan)
+{
+  free(chan->buf);
+  free(chan->seq);
+  chan->buf = NULL;
+  chan->seq = NULL;
+}
+
+void chan_tbl_destroy(chan_tbl_t *tbl)
+{
+  for (int i = 0; i < MAX_CHAN; i++) {
+    chan_t *chan = atomic_load(&tbl->chan[i]);
+    if (chan) {
+      chan_release(chan);
+      free(chan);
+    }
+  }
+  
+  chan_t *chan = atomic_load(&tbl->free);
+  while (chan) {
+    chan_t *next = chan->next;
+    free(chan);
+    chan = next;
+  }
+  
+  pthread_mutex_destroy(&tbl->lock);
+}
+
+static void chan_push_free(chan_tbl_t *tbl, chan_t *chan)
+{
+  chan_t *head = atomic_load(&tbl->free);
+  do {
+    chan->next = head;
+  } while (!atomic_compare_exchange_weak(&tbl->free, &head, chan));
+}
+
+static chan_t *chan_pop_free(chan_tbl_t *tbl)
+{
+  chan_t *head = atomic_load(&tbl->free);
+  while (head && !atomic_compare_exchange_weak(&tbl->free, &head, head->next));
+  
+  return head;
+}
+
+static int chan_is_drained(chan_t *chan)
+{
+  return atomic_load(&chan->f_closed)
+    && atomic_load(&chan->ref) == 1
+    && atomic_load(&chan->head) == atomic_load(&chan->tail);
+}
+
+static int chan_reclaim(chan_tbl_t *tbl)
+{
+  int slot = -1;
+  
+  for (int i = 0; i < MAX_CHAN; i++) {
+    chan_t *chan = atomic_load(&tbl->chan[i]);
+    if (!chan_is_drained(chan))
+      continue;
+    
+    atomic_store(&chan->gen, 0);
+    atomic_store(&tbl->chan[i], NULL);
+    atomic_store(&chan->f_dead, 1);
+    chan_put(tbl, chan);
+    
+    if (slot < 0)
+      slot = i;
+  }
+  
+  return slot;
+}
+
+static int chan_slot(chan_tbl_t *tbl)
+{
+  for (int i = 0; i < MAX_CHAN; i++) {
+    if (!atomic_load_explicit(&tbl->chan[i], memory_order_relaxed))
+      return i;
+  }
+  
+  return chan_reclaim(tbl);
+}
+
+int chan_new(chan_tbl_t *tbl, chan_mode_t mode, int cap, int size)
+{
+  if ((mode != CHAN_SPSC && mode != CHAN_MPMC) || cap < 1 || size < 1)
+    return -1;
+  
+  long n = 1;
+  while (n < cap)
+    n *= 2;
+  
+  pthread_mutex_lock(&tbl->lock);
+  
+  int slot = chan_slot(tbl);
+  chan_t *chan = slot < 0 ? NULL : chan_pop_free(tbl);
+  
+  if (slot >= 0 && !chan) {
+    chan = aligned_alloc(CACHE_LINE, sizeof(chan_t));
+    if (chan) {
+      atomic_init(&chan->gen, 0);
+      atomic_init(&chan->ref, 0);
+      atomic_init(&chan->f_dead, 0);
+    }
+  }
+  
+  if (!chan) {
+    pthread_mutex_unlock(&tbl->lock);
+    return -1;
+  }
+  
+  chan->buf = malloc(n * size);
+  chan->seq = mode == CHAN_MPMC ? malloc(n * sizeof(atomic_long)) : NULL;
+  
+  if (!chan->buf || (mode == CHAN_MPMC && !chan->seq)) {
+    chan_release(chan);
+    chan_push_free(tbl, chan);
+    pthread_mutex_unlock(&tbl->lock);
+    return -1;
+  }
+  
+  chan->mode = mode;
+  chan->size = size;
+  chan->cap = n;
+  chan->mask = n - 1;
+  chan->tail_cache = 0;
+  chan->head_cache = 0;
+  atomic_store(&chan->head, 0);
+  atomic_store(&chan->tail, 0);
+  atomic_store(&chan->f_closed, 0);
+  
+  if (mode == CHAN_MPMC) {
+    for (long i = 0; i < n; i++)
+      atomic_init(&chan->seq[i], i);
+  }
+  
+  int gen = atomic_load(&tbl->gen) % (INT_MAX / MAX_CHAN - 1) + 1;
+  atomic_store(&tbl->gen, gen);
+  
+  atomic_fetch_add(&chan->ref, 1);
+  atomic_store(&chan->gen, gen);
+  atomic_store(&tbl->chan[slot], chan);
+  
+  pthread_mutex_unlock(&tbl->lock);
+  
+  return gen * MAX_CHAN + slot;
+}
+
+chan_t *chan_get(chan_tbl_t *tbl, int handle)
+{
+  int gen = handle / MAX_CHAN;
+  
+  if (handle < 0 || gen < 1 || gen > atomic_load_explicit(&tbl->gen, memory_order_acquire))
+    return NULL;
+  
+  chan_t *chan = atomic_load(&tbl->chan[handle % MAX_CHAN]);
+  if (!chan)
+    return &chan_dead;
+  
+  atomic_fetch_add(&chan->ref, 1);
+  
+  if (atomic_load(&chan->gen) != gen) {
+    chan_put(tbl, chan);
+    return &chan_dead;
+  }
+  
+  return chan;
+}
+
+void chan_put(chan_tbl_t *tbl, chan_t *chan)
+{
+  if (chan == &chan_dead)
+    return;
+  
+  if (atomic_fetch_sub(&chan->ref, 1) == 1 && atomic_exchange(&chan->f_dead, 0)) {
+    chan_release(chan);
+    chan_push_free(tbl, chan);
+  }
+}
+
+static int spsc_send(chan_t *chan, const char *src)
+{
+  long tail = atomic_load_explicit(&chan->tail, memory_order_relaxed);
+  
+  if (tail - chan->head_cache == chan->cap) {
+    chan->head_cache = atomic_load_explicit(&chan->head, memory_order_acquire);
+    if (tail - chan->head_cache == chan->cap)
+      return 0;
+  }
+  
+  memcpy(chan->buf + (tail & chan->mask) * chan->size, src, chan->size);
+  atomic_store_explicit(&chan->tail, tail + 1, memory_order_release);
+  
+  return 1;
+}
+
+static int spsc_recv(chan_t *chan, char *dst)
+{
+  long head = atomic_load_explicit(&chan->head, memory_order_relaxed);
+  
+  if (head == chan->tail_cache) {
+    chan->tail_cache = atomic_load_explicit(&chan->tail, memory_order_acquire);
+    if (head == chan->tail_cache)
+      return 0;
+  }
+  
+  memcpy(dst, chan->buf + (head & chan->mask) * chan->size, chan->size);
+  atomic_store_explicit(&chan->head, head + 1, memory_order_release);
+  
+  return 1;
+}
+
+static int mpmc_send(chan_t *chan, const char *src)
+{
+  long pos = atomic_load_explicit(&chan->tail, memory_order_relaxed);
+  
+  while (1) {
+    long seq = atomic_load_explicit(&chan->seq[pos & chan->mask], memory_order_acquire);
+    long diff = seq - pos;
+    
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&chan->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = atomic_load_explicit(&chan->tail, memory_order_relaxed);
+    }
+  }
+  
+  memcpy(chan->buf + (pos & chan->mask) * chan->size, src, chan->size);
+  atomic_store_explicit(&chan->seq[pos & chan->mask], pos + 1, memory_order_release);
+  
+  return 1;
+}
+
+static int mpmc_recv(chan_t *chan, char *dst)
+{
+  long pos = atomic_load_explicit(&chan->head, memory_order_relaxed);
+  
+  while (1) {
+    long seq = atomic_load_explicit(&chan->seq[pos & chan->mask], memory_order_acquire);
+    long diff = seq - (pos + 1);
+    
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&chan->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = atomic_load_explicit(&chan->head, memory_order_relaxed);
+    }
+  }
+  
+  memcpy(dst, chan->buf + (pos & chan->mask) * chan->size, chan->size);
+  atomic_store_explicit(&chan->seq[pos & chan->mask], pos + chan->mask + 1, memory_order_release);
+  
+  return 1;
+}
+
+int chan_send(chan_t *chan, const char *src)
+{
+  if (atomic_load_explicit(&chan->f_closed, memory_order_relaxed))
+    return -1;
+  
+  if (chan->mode == CHAN_SPSC)
+    return spsc_send(chan, src);
+  else
+    return mpmc_send(chan, src);
+}
+
+int chan_recv(chan_t *chan, char *dst)
+{
+  int ret;
+  
+  if (chan->mode == CHAN_SPSC)
+    ret = spsc_recv(chan, dst);
+  else
+    ret = mpmc_recv(chan, dst);
+  
+  if (!ret && atomic_load_explicit(&chan->f_closed, memory_order_acquire)) {
+    if (chan->mode == CHAN_SPSC)
+      ret = spsc_recv(chan, dst);
+    else
+      ret = mpmc_recv(chan, dst);
+    
+    if (!ret)
+      return -1;
+  }
+  
+  return ret;
+}
+
+int chan_send_wait(chan_t *chan, const char *src)
+{
+  int ret;
+  
+  for (int spin = 0; !(ret = chan_send(chan, src)); spin++) {
+    if (spin >= CHAN_SPIN)
+      sched_yield();
+  }
+  
+  return ret;
+}
+
+int chan_recv_wait(chan_t *chan, char *dst)
+{
+  int ret;
+  
+  for (int spin = 0; !(ret = chan_recv(chan, dst)); spin++) {
+    if (spin >= CHAN_SPIN)
+      sched_yield();
+  }
+  
+  return ret;
+}
+
+void chan_close(chan_t *chan)
+{
+  atomic_store_explicit(&chan->f_closed, 1, memory_order_release);
+}
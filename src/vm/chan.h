@@ -0,0 +1,59 @@
+#ifndef CHAN_H
+#define CHAN_H
+
+#include "../common/deque.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define MAX_CHAN 256
+#define CHAN_SPIN 64
+
+typedef struct chan_s chan_t;
+typedef struct chan_tbl_s chan_tbl_t;
+typedef enum chan_mode_e chan_mode_t;
+
+enum chan_mode_e {
+  CHAN_SPSC,
+  CHAN_MPMC
+};
+
+struct chan_s {
+  chan_mode_t mode;
+  int size;
+  long cap;
+  long mask;
+  char *buf;
+  atomic_long *seq;
+  chan_t *next;
+  
+  _Alignas(CACHE_LINE) atomic_long head;
+  long tail_cache;
+  
+  _Alignas(CACHE_LINE) atomic_long tail;
+  long head_cache;
+  
+  _Alignas(CACHE_LINE) atomic_int f_closed;
+  atomic_int gen;
+  atomic_int ref;
+  atomic_int f_dead;
+};
+
+struct chan_tbl_s {
+  pthread_mutex_t lock;
+  _Atomic(chan_t*) chan[MAX_CHAN];
+  _Atomic(chan_t*) free;
+  atomic_int gen;
+};
+
+void chan_tbl_init(chan_tbl_t *tbl);
+void chan_tbl_destroy(chan_tbl_t *tbl);
+int chan_new(chan_tbl_t *tbl, chan_mode_t mode, int cap, int size);
+chan_t *chan_get(chan_tbl_t *tbl, int handle);
+void chan_put(chan_tbl_t *tbl, chan_t *chan);
+int chan_send(chan_t *chan, const char *src);
+int chan_recv(chan_t *chan, char *dst);
+int chan_send_wait(chan_t *chan, const char *src);
+int chan_recv_wait(chan_t *chan, char *dst);
+void chan_close(chan_t *chan);
+
+#endif
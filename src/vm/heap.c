@@ -0,0 +1,456 @@
+#include "vm.h"
+
+#include "../common/error.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SIZE(B) (*(int*) &mem[B])
+#define TAG(B) (*(int*) &mem[(B) + 4])
+#define NEXT(B) (*(int*) &mem[(B) + 8])
+
+#define R_MAGIC(R) (*(int*) &mem[R])
+#define R_TOP(R) (*(int*) &mem[(R) + 4])
+#define R_END(R) (*(int*) &mem[(R) + 8])
+#define R_HEAD(R) (*(int*) &mem[(R) + 12])
+#define R_TAIL(R) (*(int*) &mem[(R) + 16])
+#define R_BIG(R) (*(int*) &mem[(R) + 20])
+
+static const int class_size[HEAP_CLASS] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+void heap_init(heap_t *heap)
+{
+  memset(heap, 0, sizeof(heap_t));
+  heap->arena_size = HEAP_ARENA;
+  pthread_mutex_init(&heap->lock, NULL);
+}
+
+void heap_destroy(heap_t *heap)
+{
+  pthread_mutex_destroy(&heap->lock);
+}
+
+static int heap_lock(proc_t *proc)
+{
+  if (atomic_load_explicit(&proc->num_thread, memory_order_acquire) == 1)
+    return 0;
+  
+  pthread_mutex_lock(&proc->heap.lock);
+  
+  return 1;
+}
+
+static void heap_unlock(proc_t *proc, int locked)
+{
+  if (locked)
+    pthread_mutex_unlock(&proc->heap.lock);
+}
+
+static int size_class(int size)
+{
+  if (size <= 64)
+    return (size - 1) >> 4;
+  
+  int log = 31 - __builtin_clz(size - 1);
+  
+  return 4 + (log - 6) * 2 + (((size - 1) >> (log - 1)) & 1);
+}
+
+static void large_insert(heap_t *heap, char *mem, int block, int size)
+{
+  int prev = 0;
+  int next = heap->large;
+  
+  while (next && next < block) {
+    prev = next;
+    next = NEXT(next);
+  }
+  
+  SIZE(block) = size;
+  TAG(block) = HEAP_FREE;
+  NEXT(block) = next;
+  
+  if (next && block + size == next) {
+    SIZE(block) += SIZE(next);
+    NEXT(block) = NEXT(next);
+  }
+  
+  if (!prev) {
+    heap->large = block;
+  } else if (prev + SIZE(prev) == block) {
+    SIZE(prev) += SIZE(block);
+    NEXT(prev) = NEXT(block);
+  } else {
+    NEXT(prev) = block;
+  }
+}
+
+static int new_arena(vm_t *vm, heap_t *heap, int need)
+{
+  int size = heap->arena_size;
+  
+  if (need > size - HEAP_HEADER)
+    size = (need + HEAP_HEADER + 4095) & ~4095;
+  
+  int addr = mem_map_heap(vm, size);
+  if (addr < 0)
+    return 0;
+  
+  if (heap->arena_size < HEAP_MAX_ARENA)
+    heap->arena_size *= 2;
+  
+  heap->mapped += size;
+  heap->num_arena++;
+  
+  char *mem = vm->proc->mem;
+  
+  int fence = addr + size - HEAP_HEADER;
+  SIZE(fence) = 0;
+  TAG(fence) = HEAP_USED;
+  
+  large_insert(heap, mem, addr, size - HEAP_HEADER);
+  
+  return 1;
+}
+
+static int large_take(vm_t *vm, heap_t *heap, int size)
+{
+  char *mem = vm->proc->mem;
+  
+  while (1) {
+    int prev = 0;
+    
+    for (int block = heap->large; block; prev = block, block = NEXT(block)) {
+      int avail = SIZE(block);
+      if (avail < size)
+        continue;
+      
+      int rest = NEXT(block);
+      
+      if (avail - size >= HEAP_SPLIT) {
+        int split = block + size;
+        SIZE(split) = avail - size;
+        TAG(split) = HEAP_FREE;
+        NEXT(split) = rest;
+        
+        rest = split;
+        avail = size;
+      }
+      
+      if (prev)
+        NEXT(prev) = rest;
+      else
+        heap->large = rest;
+      
+      SIZE(block) = avail;
+      TAG(block) = HEAP_USED;
+      
+      return block;
+    }
+    
+    if (!new_arena(vm, heap, size))
+      return 0;
+  }
+}
+
+static int small_take(vm_t *vm, heap_t *heap, int c)
+{
+  char *mem = vm->proc->mem;
+  
+  int block = heap->free[c];
+  if (block) {
+    heap->free[c] = NEXT(block);
+    TAG(block) = HEAP_USED;
+    return block;
+  }
+  
+  int size = class_size[c] + HEAP_HEADER;
+  
+  if (heap->end - heap->top < size) {
+    if (heap->end - heap->top >= HEAP_SPLIT)
+      large_insert(heap, mem, heap->top, heap->end - heap->top);
+    
+    int chunk = large_take(vm, heap, HEAP_CHUNK);
+    if (!chunk)
+      return 0;
+    
+    heap->top = chunk;
+    heap->end = chunk + SIZE(chunk);
+  }
+  
+  block = heap->top;
+  heap->top += size;
+  
+  SIZE(block) = size;
+  TAG(block) = HEAP_USED;
+  
+  return block;
+}
+
+static int find_block(vm_t *vm, int ptr, const char *name)
+{
+  char *mem = vm->proc->mem;
+  
+  if (ptr % HEAP_HEADER || ptr < MAP_BASE + HEAP_HEADER || !mem_is_writable(vm, ptr - HEAP_HEADER, HEAP_HEADER))
+    error("%s: invalid pointer %i", name, ptr);
+  
+  int block = ptr - HEAP_HEADER;
+  
+  if (TAG(block) == HEAP_FREE)
+    error("%s: %i was already freed", name, ptr);
+  
+  if (TAG(block) != HEAP_USED || SIZE(block) <= HEAP_HEADER)
+    error("%s: invalid pointer %i", name, ptr);
+  
+  return block;
+}
+
+static int do_alloc(vm_t *vm, heap_t *heap, int size)
+{
+  if (size <= 0 || size > MAP_SPACE - MAP_BASE)
+    return 0;
+  
+  int block;
+  
+  if (size <= HEAP_SMALL) {
+    int c = size_class(size);
+    
+    if ((block = small_take(vm, heap, c)))
+      heap->class_alloc[c]++;
+  } else {
+    if ((block = large_take(vm, heap, (size + HEAP_HEADER + 7) & ~7)))
+      heap->num_large++;
+  }
+  
+  if (!block)
+    return 0;
+  
+  char *mem = vm->proc->mem;
+  
+  heap->num_alloc++;
+  heap->in_use += SIZE(block);
+  
+  if (heap->in_use > heap->peak)
+    heap->peak = heap->in_use;
+  
+  return block + HEAP_HEADER;
+}
+
+static void do_free(vm_t *vm, heap_t *heap, int ptr)
+{
+  char *mem = vm->proc->mem;
+  
+  int block = find_block(vm, ptr, "free");
+  int size = SIZE(block);
+  
+  heap->num_free++;
+  heap->in_use -= size;
+  
+  if (size - HEAP_HEADER <= HEAP_SMALL) {
+    int c = size_class(size - HEAP_HEADER);
+    TAG(block) = HEAP_FREE;
+    NEXT(block) = heap->free[c];
+    heap->free[c] = block;
+  } else {
+    large_insert(heap, mem, block, size);
+  }
+}
+
+int heap_alloc(vm_t *vm, int size)
+{
+  int locked = heap_lock(vm->proc);
+  int ptr = do_alloc(vm, &vm->proc->heap, size);
+  heap_unlock(vm->proc, locked);
+  
+  return ptr;
+}
+
+void heap_free(vm_t *vm, int ptr)
+{
+  if (!ptr)
+    return;
+  
+  int locked = heap_lock(vm->proc);
+  do_free(vm, &vm->proc->heap, ptr);
+  heap_unlock(vm->proc, locked);
+}
+
+int heap_realloc(vm_t *vm, int ptr, int size)
+{
+  if (!ptr)
+    return heap_alloc(vm, size);
+  
+  if (size <= 0) {
+    heap_free(vm, ptr);
+    return 0;
+  }
+  
+  heap_t *heap = &vm->proc->heap;
+  char *mem = vm->proc->mem;
+  
+  int locked = heap_lock(vm->proc);
+  
+  heap->num_realloc++;
+  
+  int old = SIZE(find_block(vm, ptr, "realloc")) - HEAP_HEADER;
+  int new = ptr;
+  
+  if (size > old) {
+    new = do_alloc(vm, heap, size);
+    
+    if (new) {
+      memcpy(&mem[new], &mem[ptr], old);
+      do_free(vm, heap, ptr);
+    }
+  }
+  
+  heap_unlock(vm->proc, locked);
+  
+  return new;
+}
+
+int heap_region_new(vm_t *vm)
+{
+  heap_t *heap = &vm->proc->heap;
+  char *mem = vm->proc->mem;
+  
+  int locked = heap_lock(vm->proc);
+  
+  int r = do_alloc(vm, heap, 24);
+  
+  if (r) {
+    R_MAGIC(r) = REGION_MAGIC;
+    R_TOP(r) = 0;
+    R_END(r) = 0;
+    R_HEAD(r) = 0;
+    R_TAIL(r) = 0;
+    R_BIG(r) = 0;
+    
+    heap->num_region++;
+  }
+  
+  heap_unlock(vm->proc, locked);
+  
+  return r;
+}
+
+static void region_find(vm_t *vm, int r, const char *name)
+{
+  char *mem = vm->proc->mem;
+  
+  find_block(vm, r, name);
+  
+  if (R_MAGIC(r) != REGION_MAGIC)
+    error("%s: invalid region %i", name, r);
+}
+
+static int region_grow(vm_t *vm, heap_t *heap, int r, int size)
+{
+  char *mem = vm->proc->mem;
+  
+  if (size > REGION_BIG) {
+    int block = large_take(vm, heap, size + REGION_HEADER);
+    if (!block)
+      return 0;
+    
+    NEXT(block) = R_BIG(r);
+    R_BIG(r) = block;
+    
+    return block + REGION_HEADER;
+  }
+  
+  int chunk = heap->spare;
+  
+  if (chunk) {
+    heap->spare = NEXT(chunk);
+  } else {
+    if (!(chunk = large_take(vm, heap, REGION_CHUNK)))
+      return 0;
+    
+    heap->num_chunk++;
+  }
+  
+  NEXT(chunk) = R_HEAD(r);
+  R_HEAD(r) = chunk;
+  
+  if (!R_TAIL(r))
+    R_TAIL(r) = chunk;
+  
+  R_TOP(r) = chunk + REGION_HEADER + size;
+  R_END(r) = chunk + SIZE(chunk);
+  
+  return chunk + REGION_HEADER;
+}
+
+int heap_region_alloc(vm_t *vm, int r, int size)
+{
+  if (size <= 0 || size > MAP_SPACE - MAP_BASE)
+    return 0;
+  
+  size = (size + 7) & ~7;
+  
+  heap_t *heap = &vm->proc->heap;
+  char *mem = vm->proc->mem;
+  
+  int locked = heap_lock(vm->proc);
+  
+  region_find(vm, r, "region_alloc");
+  
+  int ptr = R_TOP(r);
+  
+  if (size <= R_END(r) - ptr)
+    R_TOP(r) += size;
+  else
+    ptr = region_grow(vm, heap, r, size);
+  
+  heap->num_region_alloc++;
+  
+  heap_unlock(vm->proc, locked);
+  
+  return ptr;
+}
+
+void heap_region_free(vm_t *vm, int r)
+{
+  heap_t *heap = &vm->proc->heap;
+  char *mem = vm->proc->mem;
+  
+  int locked = heap_lock(vm->proc);
+  
+  region_find(vm, r, "region_free");
+  
+  if (R_HEAD(r)) {
+    NEXT(R_TAIL(r)) = heap->spare;
+    heap->spare = R_HEAD(r);
+  }
+  
+  int big = R_BIG(r);
+  while (big) {
+    int next = NEXT(big);
+    large_insert(heap, mem, big, SIZE(big));
+    big = next;
+  }
+  
+  R_MAGIC(r) = 0;
+  do_free(vm, heap, r);
+  
+  heap_unlock(vm->proc, locked);
+}
+
+void heap_dump(heap_t *heap)
+{
+  fprintf(stderr, "heap: %li allocs, %li frees, %li reallocs\n", heap->num_alloc, heap->num_free, heap->num_realloc);
+  fprintf(stderr, "heap: %li bytes in use, %li peak, %li mapped in %i arenas\n", heap->in_use, heap->peak, heap->mapped, heap->num_arena);
+  
+  for (int c = 0; c < HEAP_CLASS; c++) {
+    if (heap->class_alloc[c])
+      fprintf(stderr, "heap: %5i bytes: %li allocs\n", class_size[c], heap->class_alloc[c]);
+  }
+  
+  if (heap->num_large)
+    fprintf(stderr, "heap: large: %li allocs\n", heap->num_large);
+  
+  if (heap->num_region)
+    fprintf(stderr, "heap: %li regions, %li region allocs, %i chunks\n", heap->num_region, heap->num_region_alloc, heap->num_chunk);
+}
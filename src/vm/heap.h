@@ -0,0 +1,53 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <pthread.h>
+
+#define HEAP_ARENA (1024 * 1024)
+#define HEAP_MAX_ARENA (64 * 1024 * 1024)
+#define HEAP_CHUNK (64 * 1024)
+#define HEAP_HEADER 8
+#define HEAP_SMALL 2048
+#define HEAP_SPLIT 32
+#define HEAP_CLASS 14
+
+#define REGION_CHUNK (64 * 1024)
+#define REGION_BIG (REGION_CHUNK / 4)
+#define REGION_HEADER 16
+
+#define HEAP_USED 0x55504548
+#define HEAP_FREE 0x45455246
+#define REGION_MAGIC 0x4e474552
+
+typedef struct heap_s heap_t;
+
+struct heap_s {
+  pthread_mutex_t lock;
+  
+  int free[HEAP_CLASS];
+  int top;
+  int end;
+  int large;
+  int spare;
+  int arena_size;
+  
+  long num_alloc;
+  long num_free;
+  long num_realloc;
+  long num_large;
+  long class_alloc[HEAP_CLASS];
+  long in_use;
+  long peak;
+  long mapped;
+  int num_arena;
+  
+  long num_region;
+  long num_region_alloc;
+  int num_chunk;
+};
+
+void heap_init(heap_t *heap);
+void heap_destroy(heap_t *heap);
+void heap_dump(heap_t *heap);
+
+#endif
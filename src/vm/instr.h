@@ -35,7 +35,13 @@ enum instr_e {
   SETGE,
   SX8_32,
   SX32_8,
-  INT
+  INT,
+  NCALL,
+  POP,
+  XCHG,
+  CAS,
+  FADD,
+  FENCE
 };
 
 #endif
@@ -0,0 +1,325 @@
+#include "io.h"
+
+#include "../common/error.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+void io_init(io_t *io, int fd_in, int fd_out)
+{
+  io->fd_in = fd_in;
+  io->f_eof = 0;
+  io->in_buf = NULL;
+  io->in_pos = 0;
+  io->in_len = 0;
+  
+  io->fd_out = fd_out;
+  io->f_line = 0;
+  io->out_buf = NULL;
+  io->out_len = 0;
+}
+
+void io_free(io_t *io)
+{
+  io_flush(io);
+  free(io->in_buf);
+  free(io->out_buf);
+}
+
+int io_in_ready(io_t *io)
+{
+  if (io->in_pos < io->in_len || io->f_eof)
+    return 1;
+  
+  struct pollfd pfd = { io->fd_in, POLLIN, 0 };
+  
+  return poll(&pfd, 1, 0) != 0;
+}
+
+static int read_some(int fd, char *dst, int len)
+{
+  while (1) {
+    ssize_t n = read(fd, dst, len);
+    
+    if (n >= 0)
+      return n;
+    
+    if (errno != EINTR)
+      error("read: %s", strerror(errno));
+  }
+}
+
+static int refill(io_t *io)
+{
+  if (io->f_eof)
+    return 0;
+  
+  if (!io->in_buf)
+    io->in_buf = malloc(MAX_IN);
+  
+  int kept = io->in_len - io->in_pos;
+  memmove(io->in_buf, io->in_buf + io->in_pos, kept);
+  
+  int n = read_some(io->fd_in, io->in_buf + kept, MAX_IN - kept);
+  
+  io->in_pos = 0;
+  io->in_len = kept + n;
+  
+  if (!n)
+    io->f_eof = 1;
+  
+  return n;
+}
+
+static inline int peek_at(io_t *io, int i)
+{
+  while (io->in_pos + i >= io->in_len) {
+    if (!refill(io))
+      return -1;
+  }
+  
+  return (unsigned char) io->in_buf[io->in_pos + i];
+}
+
+static inline int peek(io_t *io)
+{
+  return peek_at(io, 0);
+}
+
+static inline int is_space(int c)
+{
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+int io_read(io_t *io, char *dst, int len)
+{
+  int available = io->in_len - io->in_pos;
+  
+  if (!available) {
+    if (len >= MAX_IN) {
+      if (io->f_eof)
+        return 0;
+      
+      int n = read_some(io->fd_in, dst, len);
+      if (!n)
+        io->f_eof = 1;
+      
+      return n;
+    }
+    
+    if (!(available = refill(io)))
+      return 0;
+  }
+  
+  int n = len < available ? len : available;
+  memcpy(dst, io->in_buf + io->in_pos, n);
+  io->in_pos += n;
+  
+  return n;
+}
+
+int io_read_i32(io_t *io, int *i32)
+{
+  int c;
+  while (is_space(c = peek(io)))
+    io->in_pos++;
+  
+  if (c == -1)
+    return -1;
+  
+  int sign = c == '-';
+  c = peek_at(io, sign);
+  
+  if (c < '0' || c > '9') {
+    while ((c = peek(io)) != -1 && !is_space(c))
+      io->in_pos++;
+    
+    return 0;
+  }
+  
+  io->in_pos += sign;
+  
+  unsigned int n = 0;
+  while (1) {
+    char *p = io->in_buf + io->in_pos;
+    char *end = io->in_buf + io->in_len;
+    
+    while (p < end && (unsigned char) (*p - '0') < 10)
+      n = n * 10 + (*p++ - '0');
+    
+    io->in_pos = p - io->in_buf;
+    
+    if (p < end || !refill(io))
+      break;
+  }
+  
+  *i32 = sign ? -n : n;
+  
+  return 1;
+}
+
+int io_read_line(io_t *io, char *dst, int len)
+{
+  if (peek(io) == -1)
+    return -1;
+  
+  int n = 0;
+  while (n < len - 1) {
+    if (io->in_pos == io->in_len && !refill(io))
+      break;
+    
+    char *p = io->in_buf + io->in_pos;
+    int available = io->in_len - io->in_pos;
+    
+    char *nl = memchr(p, '\n', available);
+    int chunk = nl ? nl - p : available;
+    
+    if (chunk > len - 1 - n) {
+      memcpy(dst + n, p, len - 1 - n);
+      io->in_pos += len - 1 - n;
+      n = len - 1;
+      break;
+    }
+    
+    memcpy(dst + n, p, chunk);
+    n += chunk;
+    io->in_pos += chunk;
+    
+    if (nl) {
+      io->in_pos++;
+      break;
+    }
+  }
+  
+  dst[n] = '\0';
+  
+  return n;
+}
+
+static void write_all(int fd, struct iovec *iov, int num_iov)
+{
+  while (num_iov > 0) {
+    ssize_t n = writev(fd, iov, num_iov);
+    
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      error("write: %s", strerror(errno));
+    }
+    
+    while (num_iov > 0 && n >= (ssize_t) iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      num_iov--;
+    }
+    
+    if (num_iov > 0) {
+      iov->iov_base = (char*) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+static void reserve(io_t *io, int len)
+{
+  if (!io->out_buf)
+    io->out_buf = malloc(MAX_OUT);
+  
+  if (io->out_len + len > MAX_OUT)
+    io_flush(io);
+}
+
+void io_flush(io_t *io)
+{
+  if (!io->out_len)
+    return;
+  
+  struct iovec iov = { io->out_buf, io->out_len };
+  write_all(io->fd_out, &iov, 1);
+  
+  io->out_len = 0;
+}
+
+void io_put_str(io_t *io, const char *str)
+{
+  int len = strlen(str);
+  
+  if (!io->out_buf)
+    io->out_buf = malloc(MAX_OUT);
+  
+  if (io->out_len + len > MAX_OUT) {
+    struct iovec iov[2] = {
+      { io->out_buf, io->out_len },
+      { (char*) str, len }
+    };
+    
+    write_all(io->fd_out, iov, 2);
+    io->out_len = 0;
+    
+    return;
+  }
+  
+  memcpy(io->out_buf + io->out_len, str, len);
+  io->out_len += len;
+  
+  if (io->f_line && memchr(str, '\n', len))
+    io_flush(io);
+}
+
+int io_itoa(char *buf, int i32)
+{
+  char tmp[MAX_I32_STR];
+  char *p = &tmp[MAX_I32_STR];
+  
+  unsigned int n = i32 < 0 ? -(unsigned int) i32 : (unsigned int) i32;
+  
+  while (n >= 100) {
+    const char *pair = &digit_pairs[(n % 100) * 2];
+    n /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  
+  if (n >= 10) {
+    const char *pair = &digit_pairs[n * 2];
+    *--p = pair[1];
+    *--p = pair[0];
+  } else {
+    *--p = '0' + n;
+  }
+  
+  if (i32 < 0)
+    *--p = '-';
+  
+  int len = &tmp[MAX_I32_STR] - p;
+  memcpy(buf, p, len);
+  
+  return len;
+}
+
+void io_put_i32(io_t *io, int i32)
+{
+  reserve(io, MAX_I32_STR);
+  
+  io->out_len += io_itoa(io->out_buf + io->out_len, i32);
+  io->out_buf[io->out_len++] = '\n';
+  
+  if (io->f_line)
+    io_flush(io);
+}
@@ -0,0 +1,34 @@
+#ifndef IO_H
+#define IO_H
+
+#define MAX_OUT (64 * 1024)
+#define MAX_IN (256 * 1024)
+#define MAX_I32_STR 12
+
+typedef struct io_s io_t;
+
+struct io_s {
+  int fd_in;
+  int f_eof;
+  char *in_buf;
+  int in_pos;
+  int in_len;
+  
+  int fd_out;
+  int f_line;
+  char *out_buf;
+  int out_len;
+};
+
+void io_init(io_t *io, int fd_in, int fd_out);
+void io_free(io_t *io);
+int io_in_ready(io_t *io);
+int io_read(io_t *io, char *dst, int len);
+int io_read_i32(io_t *io, int *i32);
+int io_read_line(io_t *io, char *dst, int len);
+void io_put_str(io_t *io, const char *str);
+void io_put_i32(io_t *io, int i32);
+void io_flush(io_t *io);
+int io_itoa(char *buf, int i32);
+
+#endif
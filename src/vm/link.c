@@ -0,0 +1,134 @@
+#include "bin.h"
+
+#include "vm.h"
+#include "../common/map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct export_s export_t;
+
+struct export_s {
+  int pos;
+  int obj;
+};
+
+bin_t *bin_link(bin_t **obj, char **name, int num_obj)
+{
+  int *code_base = malloc(num_obj * sizeof(int));
+  int *bss_base = malloc(num_obj * sizeof(int));
+  int *data_base = malloc(num_obj * sizeof(int));
+  
+  int num_instr = num_obj * 2 + 2;
+  int bss_size = 0;
+  int data_size = 0;
+  int num_sym = 1;
+  int num_line = 0;
+  
+  for (int i = 0; i < num_obj; i++) {
+    code_base[i] = num_instr;
+    bss_base[i] = bss_size;
+    data_base[i] = data_size;
+    
+    num_instr += obj[i]->num_instr;
+    bss_size += obj[i]->bss_size;
+    data_size += obj[i]->data_size;
+    num_sym += obj[i]->num_sym;
+    num_line += obj[i]->num_line;
+  }
+  
+  map_t map_export = make_map();
+  
+  for (int i = 0; i < num_obj; i++) {
+    for (int j = 0; j < obj[i]->num_export; j++) {
+      sym_t *sym = &obj[i]->export[j];
+      export_t *prev = map_get(map_export, sym->name);
+      
+      if (prev) {
+        fprintf(stderr, "duplicate symbol '%s' in %s and %s\n", hash_get(sym->name), name[prev->obj], name[i]);
+        return NULL;
+      }
+      
+      export_t *e = malloc(sizeof(export_t));
+      e->pos = code_base[i] + sym->pos;
+      e->obj = i;
+      map_put(map_export, sym->name, e);
+    }
+  }
+  
+  instr_t *instr = malloc((num_instr + 1) * sizeof(instr_t));
+  char *data = malloc(data_size + 1);
+  sym_t *sym = malloc(num_sym * sizeof(sym_t));
+  line_t *line = malloc((num_line + 1) * sizeof(line_t));
+  
+  int ip = 0;
+  for (int i = 0; i < num_obj; i++) {
+    instr[ip++] = CALL;
+    instr[ip++] = code_base[i];
+  }
+  
+  instr[ip++] = INT;
+  instr[ip++] = (instr_t) SYS_EXIT;
+  
+  sym[0].name = hash_value("_start");
+  sym[0].pos = 0;
+  num_sym = 1;
+  num_line = 0;
+  
+  for (int i = 0; i < num_obj; i++) {
+    bin_t *o = obj[i];
+    
+    memcpy(&instr[code_base[i]], o->instr, o->num_instr * sizeof(instr_t));
+    memcpy(&data[data_base[i]], o->data, o->data_size);
+    
+    for (int j = 0; j < o->num_reloc; j++) {
+      reloc_t *reloc = &o->reloc[j];
+      instr_t *op = &instr[code_base[i] + reloc->pos];
+      export_t *e;
+      
+      switch (reloc->type) {
+      case RELOC_CODE:
+        *op += code_base[i];
+        break;
+      case RELOC_BSS:
+        *op += bss_base[i];
+        break;
+      case RELOC_DATA:
+        *op += bss_size + data_base[i] - o->bss_size;
+        break;
+      case RELOC_SYM:
+        if (!(e = map_get(map_export, reloc->name))) {
+          fprintf(stderr, "undefined symbol '%s' referenced in %s\n", hash_get(reloc->name), name[i]);
+          return NULL;
+        }
+        
+        *op = e->pos;
+        break;
+      }
+    }
+    
+    for (int j = 0; j < o->num_sym; j++) {
+      sym[num_sym].name = o->sym[j].name;
+      sym[num_sym].pos = code_base[i] + o->sym[j].pos;
+      num_sym++;
+    }
+    
+    for (int j = 0; j < o->num_line; j++) {
+      line[num_line] = o->line[j];
+      line[num_line].pos += code_base[i];
+      num_line++;
+    }
+  }
+  
+  free(code_base);
+  free(bss_base);
+  free(data_base);
+  
+  bin_t *bin = make_bin(instr, num_instr, data, data_size, bss_size);
+  bin->sym = sym;
+  bin->num_sym = num_sym;
+  bin->line = line;
+  bin->num_line = num_line;
+  
+  return bin;
+}
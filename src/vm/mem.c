@@ -0,0 +1,239 @@
+#include "vm.h"
+
+#include "../common/error.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MEM_PAGE 4096
+#define PAGE_ALIGN(X) (((X) + MEM_PAGE - 1) & ~(MEM_PAGE - 1))
+
+char *mem_reserve()
+{
+  char *mem = mmap(NULL, MAP_SPACE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED)
+    error("mmap: %s", strerror(errno));
+  
+  if (mprotect(mem, MAX_MEM, PROT_READ | PROT_WRITE) < 0)
+    error("mprotect: %s", strerror(errno));
+  
+  return mem;
+}
+
+void mem_release(char *mem)
+{
+  munmap(mem, MAP_SPACE);
+}
+
+static int find_gap(proc_t *proc, int size, int *slot)
+{
+  int addr = MAP_BASE;
+  
+  int i;
+  for (i = 0; i < proc->num_region; i++) {
+    if (proc->region[i].addr - addr >= size)
+      break;
+    
+    addr = proc->region[i].addr + PAGE_ALIGN(proc->region[i].size);
+  }
+  
+  if (size > MAP_SPACE - addr)
+    return -1;
+  
+  *slot = i;
+  
+  return addr;
+}
+
+static int mem_map(proc_t *proc, int fd, int size, mmap_flag_t flag)
+{
+  if (size <= 0 || size > MAP_SPACE - MAP_BASE || proc->num_region >= MAX_REGION)
+    return -1;
+  
+  int slot;
+  int addr = find_gap(proc, PAGE_ALIGN(size), &slot);
+  if (addr < 0)
+    return -1;
+  
+  int prot = PROT_READ;
+  if (flag != MMAP_READ)
+    prot |= PROT_WRITE;
+  
+  int map_flag = MAP_PRIVATE | MAP_FIXED;
+  if (flag == MMAP_ANON || flag == MMAP_HEAP)
+    map_flag |= MAP_ANONYMOUS;
+  
+  if (mmap(proc->mem + addr, size, prot, map_flag, fd, 0) == MAP_FAILED)
+    return -1;
+  
+  region_t *region = &proc->region[slot];
+  memmove(region + 1, region, (proc->num_region - slot) * sizeof(region_t));
+  
+  region->addr = addr;
+  region->size = size;
+  region->flag = flag;
+  
+  proc->num_region++;
+  
+  return addr;
+}
+
+static void mem_release_region(proc_t *proc, int i)
+{
+  region_t *region = &proc->region[i];
+  
+  void *ptr = mmap(proc->mem + region->addr, PAGE_ALIGN(region->size), PROT_NONE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  
+  if (ptr == MAP_FAILED)
+    error("mmap: %s", strerror(errno));
+  
+  memmove(region, region + 1, (proc->num_region - i - 1) * sizeof(region_t));
+  proc->num_region--;
+}
+
+int mem_map_file(vm_t *vm, const char *path, mmap_flag_t flag, int *size)
+{
+  if (flag != MMAP_READ && flag != MMAP_COPY)
+    return -1;
+  
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size > MAP_SPACE) {
+    close(fd);
+    return -1;
+  }
+  
+  int locked = proc_lock(vm->proc);
+  int addr = mem_map(vm->proc, fd, st.st_size, flag);
+  proc_unlock(vm->proc, locked);
+  
+  close(fd);
+  
+  if (addr >= 0)
+    *size = st.st_size;
+  
+  return addr;
+}
+
+int mem_unmap(vm_t *vm, int addr)
+{
+  proc_t *proc = vm->proc;
+  int locked = proc_lock(proc);
+  
+  for (int i = 0; i < proc->num_region; i++) {
+    if (proc->region[i].addr != addr || proc->region[i].flag == MMAP_ANON || proc->region[i].flag == MMAP_HEAP)
+      continue;
+    
+    mem_release_region(proc, i);
+    proc_unlock(proc, locked);
+    
+    return 0;
+  }
+  
+  proc_unlock(proc, locked);
+  
+  return -1;
+}
+
+int mem_map_stack(vm_t *vm, int size)
+{
+  int locked = proc_lock(vm->proc);
+  int addr = mem_map(vm->proc, -1, size, MMAP_ANON);
+  proc_unlock(vm->proc, locked);
+  
+  return addr;
+}
+
+int mem_map_heap(vm_t *vm, int size)
+{
+  int locked = proc_lock(vm->proc);
+  int addr = mem_map(vm->proc, -1, size, MMAP_HEAP);
+  proc_unlock(vm->proc, locked);
+  
+  return addr;
+}
+
+void mem_unmap_stack(vm_t *vm, int addr)
+{
+  proc_t *proc = vm->proc;
+  int locked = proc_lock(proc);
+  
+  for (int i = 0; i < proc->num_region; i++) {
+    if (proc->region[i].addr == addr && proc->region[i].flag == MMAP_ANON) {
+      mem_release_region(proc, i);
+      break;
+    }
+  }
+  
+  proc_unlock(proc, locked);
+}
+
+static int mem_check(vm_t *vm, int addr, int len, int writable)
+{
+  if (addr < 0 || len < 0)
+    return 0;
+  
+  if (len <= MAX_MEM - addr)
+    return 1;
+  
+  proc_t *proc = vm->proc;
+  int locked = proc_lock(proc);
+  int ok = 0;
+  
+  for (int i = 0; i < proc->num_region; i++) {
+    region_t *region = &proc->region[i];
+    
+    if ((!writable || region->flag != MMAP_READ)
+    && addr >= region->addr
+    && len <= region->addr + region->size - addr) {
+      ok = 1;
+      break;
+    }
+  }
+  
+  proc_unlock(proc, locked);
+  
+  return ok;
+}
+
+char *mem_str(vm_t *vm, int addr)
+{
+  proc_t *proc = vm->proc;
+  int end = -1;
+  
+  if (addr >= 0 && addr < MAX_MEM) {
+    end = MAX_MEM;
+  } else {
+    int locked = proc_lock(proc);
+    
+    for (int i = 0; i < proc->num_region; i++) {
+      if (addr >= proc->region[i].addr && addr < proc->region[i].addr + proc->region[i].size)
+        end = proc->region[i].addr + proc->region[i].size;
+    }
+    
+    proc_unlock(proc, locked);
+  }
+  
+  if (end < 0 || !memchr(&proc->mem[addr], '\0', end - addr))
+    return NULL;
+  
+  return &proc->mem[addr];
+}
+
+int mem_is_readable(vm_t *vm, int addr, int len)
+{
+  return mem_check(vm, addr, len, 0);
+}
+
+int mem_is_writable(vm_t *vm, int addr, int len)
+{
+  return mem_check(vm, addr, len, 1);
+}
@@ -0,0 +1,60 @@
+#include "native.h"
+
+#include "vm.h"
+#include "../common/error.h"
+#include <string.h>
+
+static int native_print(vm_t *vm, int *args)
+{
+  int locked = proc_lock(vm->proc);
+  io_put_i32(&vm->proc->io, args[0]);
+  proc_unlock(vm->proc, locked);
+  
+  return 0;
+}
+
+static int native_strlen(vm_t *vm, int *args)
+{
+  char *str = mem_str(vm, args[0]);
+  if (!str)
+    error("strlen: string out of bounds: %i", args[0]);
+  
+  return strlen(str);
+}
+
+static int native_memcpy(vm_t *vm, int *args)
+{
+  if (!mem_is_writable(vm, args[0], args[2]) || !mem_is_readable(vm, args[1], args[2]))
+    error("memcpy: buffer out of bounds");
+  
+  memmove(&vm->m_i8[args[0]], &vm->m_i8[args[1]], args[2]);
+  return 0;
+}
+
+static int native_memset(vm_t *vm, int *args)
+{
+  if (!mem_is_writable(vm, args[0], args[2]))
+    error("memset: buffer out of bounds");
+  
+  memset(&vm->m_i8[args[0]], args[1], args[2]);
+  return 0;
+}
+
+native_t native_tbl[] = {
+  { "print",    "i",    1, 0, native_print    },
+  { "strlen",   "p",    1, 1, native_strlen   },
+  { "memcpy",   "ppi",  3, 0, native_memcpy   },
+  { "memset",   "pii",  3, 0, native_memset   }
+};
+
+int num_native_tbl = sizeof(native_tbl) / sizeof(native_t);
+
+int native_find(const char *name)
+{
+  for (int i = 0; i < num_native_tbl; i++) {
+    if (!strcmp(native_tbl[i].name, name))
+      return i;
+  }
+  
+  return -1;
+}
@@ -0,0 +1,21 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+typedef struct vm_s vm_t;
+typedef struct native_s native_t;
+typedef int (*native_func_t)(vm_t *vm, int *args);
+
+struct native_s {
+  char *name;
+  char *params;
+  int num_params;
+  int ret;
+  native_func_t func;
+};
+
+extern native_t native_tbl[];
+extern int num_native_tbl;
+
+int native_find(const char *name);
+
+#endif
@@ -0,0 +1,257 @@
+#include "par.h"
+
+#include "../common/error.h"
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+
+static int run_chunk(par_t *par, vm_t *vm)
+{
+  long lo = atomic_fetch_add_explicit(&par->next, par->chunk, memory_order_relaxed);
+  if (lo >= par->hi)
+    return 0;
+  
+  long hi = lo + par->chunk < par->hi ? lo + par->chunk : par->hi;
+  
+  vm->ip = par->entry;
+  vm->sp = 0;
+  vm->cp = 0;
+  vm->fp = 0;
+  vm->bp = vm->stack_addr + THREAD_STACK;
+  vm->f_exit = 0;
+  
+  vm->s_i32[vm->sp++] = par->bp;
+  vm->s_i32[vm->sp++] = hi;
+  vm->s_i32[vm->sp++] = lo;
+  
+  vm_status_t status;
+  while ((status = vm_exec(vm, INT_MAX)) != VM_EXIT && status != VM_FUEL);
+  
+  if (status == VM_FUEL) {
+    atomic_store_explicit(&par->next, par->hi, memory_order_relaxed);
+    return 0;
+  }
+  
+  return 1;
+}
+
+static void run_chunks(par_t *par, vm_t *vm)
+{
+  while (run_chunk(par, vm));
+}
+
+static void *par_main(void *arg)
+{
+  par_slot_t *slot = arg;
+  par_t *par = slot->par;
+  int round = 0;
+  
+  pthread_mutex_lock(&par->lock);
+  
+  while (1) {
+    while (par->round == round && !par->f_quit)
+      pthread_cond_wait(&par->start, &par->lock);
+    
+    if (par->f_quit)
+      break;
+    
+    round = par->round;
+    pthread_mutex_unlock(&par->lock);
+    
+    run_chunks(par, slot->vm);
+    
+    pthread_mutex_lock(&par->lock);
+    if (--par->num_busy == 0)
+      pthread_cond_broadcast(&par->done);
+  }
+  
+  pthread_mutex_unlock(&par->lock);
+  
+  return NULL;
+}
+
+static par_t *make_par(vm_t *vm)
+{
+  verify_t *verify = &vm->proc->verify;
+  
+  vfunc_t size = { 0 };
+  for (int i = 1; i < verify->num_func; i++) {
+    if (verify->func[i].max_stack > size.max_stack)
+      size.max_stack = verify->func[i].max_stack;
+    if (verify->func[i].max_call > size.max_call)
+      size.max_call = verify->func[i].max_call;
+    if (verify->func[i].max_frame > size.max_frame)
+      size.max_frame = verify->func[i].max_frame;
+  }
+  
+  int num_worker = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  if (num_worker < 0)
+    num_worker = 0;
+  
+  par_t *par = malloc(sizeof(par_t));
+  par->slot = malloc((num_worker + 1) * sizeof(par_slot_t));
+  par->num_worker = num_worker;
+  par->round = 0;
+  par->num_busy = 0;
+  par->f_quit = 0;
+  par->owner = NULL;
+  pthread_mutex_init(&par->lock, NULL);
+  pthread_cond_init(&par->start, NULL);
+  pthread_cond_init(&par->done, NULL);
+  atomic_init(&par->next, 0);
+  
+  for (int i = 0; i <= num_worker; i++) {
+    par->slot[i].par = par;
+    par->slot[i].vm = make_thread_vm(vm, &size, PAR_DEPTH);
+    par->slot[i].vm->f_par = 1;
+  }
+  
+  atomic_fetch_add(&vm->proc->num_thread, num_worker + 1);
+  
+  for (int i = 1; i <= num_worker; i++) {
+    if (pthread_create(&par->slot[i].thread, NULL, par_main, &par->slot[i]))
+      error("parfor: pthread_create failed");
+  }
+  
+  return par;
+}
+
+static void check_body(vm_t *vm, int entry)
+{
+  vfunc_t *func = verify_find(&vm->proc->verify, entry);
+  if (!func || entry == 0 || func->min_stack < -PAR_DEPTH)
+    error("parfor: %i is not a loop body", entry);
+}
+
+static par_t *get_par(vm_t *vm)
+{
+  proc_t *proc = vm->proc;
+  
+  pthread_mutex_lock(&proc->par_lock);
+  if (!proc->par)
+    proc->par = make_par(vm);
+  pthread_mutex_unlock(&proc->par_lock);
+  
+  return proc->par;
+}
+
+static void par_begin(par_t *par, int entry, int lo, int hi, int bp)
+{
+  long chunk = ((long) hi - lo) / ((par->num_worker + 1) * PAR_CHUNK);
+  
+  par->entry = entry;
+  par->bp = bp;
+  par->hi = hi;
+  par->chunk = chunk > 0 ? chunk : 1;
+  atomic_store_explicit(&par->next, lo, memory_order_relaxed);
+  
+  pthread_mutex_lock(&par->lock);
+  par->num_busy = par->num_worker;
+  par->round++;
+  pthread_cond_broadcast(&par->start);
+  pthread_mutex_unlock(&par->lock);
+}
+
+static void par_end(par_t *par)
+{
+  par->owner = NULL;
+}
+
+static int par_claim(par_t *par, vm_t *vm)
+{
+  pthread_mutex_lock(&par->lock);
+  int f_begin = !par->owner;
+  if (f_begin)
+    par->owner = vm;
+  int f_mine = par->owner == vm;
+  pthread_mutex_unlock(&par->lock);
+  
+  if (!f_mine)
+    return -1;
+  
+  return f_begin;
+}
+
+int par_run(vm_t *vm, int entry, int lo, int hi, int bp)
+{
+  check_body(vm, entry);
+  
+  if (lo >= hi)
+    return 1;
+  
+  if (vm->f_par)
+    return -1;
+  
+  par_t *par = get_par(vm);
+  
+  if (par_claim(par, vm) < 0)
+    return -1;
+  
+  par_begin(par, entry, lo, hi, bp);
+  
+  run_chunks(par, par->slot[0].vm);
+  
+  pthread_mutex_lock(&par->lock);
+  while (par->num_busy > 0)
+    pthread_cond_wait(&par->done, &par->lock);
+  par_end(par);
+  pthread_mutex_unlock(&par->lock);
+  
+  return 1;
+}
+
+int par_step(vm_t *vm, int entry, int lo, int hi, int bp)
+{
+  check_body(vm, entry);
+  
+  if (lo >= hi)
+    return 1;
+  
+  if (vm->f_par)
+    return -1;
+  
+  par_t *par = get_par(vm);
+  
+  int f_begin = par_claim(par, vm);
+  if (f_begin < 0)
+    return -1;
+  
+  if (f_begin)
+    par_begin(par, entry, lo, hi, bp);
+  
+  run_chunk(par, par->slot[0].vm);
+  
+  pthread_mutex_lock(&par->lock);
+  int f_done = atomic_load_explicit(&par->next, memory_order_relaxed) >= par->hi && par->num_busy == 0;
+  if (f_done)
+    par_end(par);
+  pthread_mutex_unlock(&par->lock);
+  
+  return f_done;
+}
+
+void par_stop(proc_t *proc)
+{
+  par_t *par = proc->par;
+  if (!par)
+    return;
+  
+  pthread_mutex_lock(&par->lock);
+  par->f_quit = 1;
+  pthread_cond_broadcast(&par->start);
+  pthread_mutex_unlock(&par->lock);
+  
+  for (int i = 1; i <= par->num_worker; i++)
+    pthread_join(par->slot[i].thread, NULL);
+  
+  for (int i = 0; i <= par->num_worker; i++)
+    free_vm(par->slot[i].vm);
+  
+  pthread_mutex_destroy(&par->lock);
+  pthread_cond_destroy(&par->start);
+  pthread_cond_destroy(&par->done);
+  free(par->slot);
+  free(par);
+  
+  proc->par = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef PAR_H
+#define PAR_H
+
+#include "vm.h"
+
+#define PAR_CHUNK 4
+#define PAR_DEPTH 3
+
+typedef struct par_slot_s par_slot_t;
+
+struct par_slot_s {
+  par_t *par;
+  vm_t *vm;
+  pthread_t thread;
+};
+
+struct par_s {
+  par_slot_t *slot;
+  int num_worker;
+  
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  int round;
+  int num_busy;
+  int f_quit;
+  vm_t *owner;
+  
+  int entry;
+  int bp;
+  int hi;
+  int chunk;
+  _Alignas(CACHE_LINE) atomic_long next;
+};
+
+int par_run(vm_t *vm, int entry, int lo, int hi, int bp);
+int par_step(vm_t *vm, int entry, int lo, int hi, int bp);
+void par_stop(proc_t *proc);
+
+#endif
@@ -0,0 +1,214 @@
+#include "pool.h"
+
+#include "../common/error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+static _Thread_local worker_t *self;
+
+pool_t *make_pool(int num_worker, int slice)
+{
+  if (num_worker < 1)
+    num_worker = sysconf(_SC_NPROCESSORS_ONLN);
+  
+  if (num_worker < 1)
+    num_worker = 1;
+  
+  pool_t *pool = malloc(sizeof(pool_t));
+  pool->worker = aligned_alloc(CACHE_LINE, num_worker * sizeof(worker_t));
+  pool->num_worker = num_worker;
+  pool->next_worker = 0;
+  pool->slice = slice;
+  atomic_init(&pool->num_task, 0);
+  atomic_init(&pool->num_ready, 0);
+  atomic_init(&pool->num_sleep, 0);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  
+  for (int i = 0; i < num_worker; i++) {
+    worker_t *worker = &pool->worker[i];
+    deque_init(&worker->deque, POOL_DEQUE);
+    worker->pool = pool;
+    worker->seed = i + 1;
+    worker->num_run = 0;
+    worker->num_steal = 0;
+  }
+  
+  return pool;
+}
+
+void free_pool(pool_t *pool)
+{
+  for (int i = 0; i < pool->num_worker; i++)
+    deque_free(&pool->worker[i].deque);
+  
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake);
+  
+  free(pool->worker);
+  free(pool);
+}
+
+static void wake(pool_t *pool, int all)
+{
+  if (!atomic_load(&pool->num_sleep))
+    return;
+  
+  pthread_mutex_lock(&pool->lock);
+  
+  if (all)
+    pthread_cond_broadcast(&pool->wake);
+  else
+    pthread_cond_signal(&pool->wake);
+  
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void park(pool_t *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  atomic_fetch_add(&pool->num_sleep, 1);
+  
+  while (atomic_load(&pool->num_ready) <= 0 && atomic_load(&pool->num_task) > 0)
+    pthread_cond_wait(&pool->wake, &pool->lock);
+  
+  atomic_fetch_sub(&pool->num_sleep, 1);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void push(worker_t *worker, vm_t *vm)
+{
+  deque_push(&worker->deque, vm);
+  atomic_fetch_add(&worker->pool->num_ready, 1);
+}
+
+static void claim(pool_t *pool)
+{
+  if (atomic_fetch_sub(&pool->num_ready, 1) > 1)
+    wake(pool, 0);
+}
+
+void pool_add(pool_t *pool, vm_t *vm)
+{
+  atomic_fetch_add(&pool->num_task, 1);
+  vm->f_nonblock = 1;
+  
+  push(&pool->worker[pool->next_worker], vm);
+  pool->next_worker = (pool->next_worker + 1) % pool->num_worker;
+  
+  wake(pool, 0);
+}
+
+int pool_submit(vm_t *vm)
+{
+  if (!self)
+    return 0;
+  
+  atomic_fetch_add(&self->pool->num_task, 1);
+  vm->f_nonblock = 1;
+  
+  push(self, vm);
+  wake(self->pool, 0);
+  
+  return 1;
+}
+
+static vm_t *steal(worker_t *worker)
+{
+  pool_t *pool = worker->pool;
+  
+  for (int i = 0; i < pool->num_worker; i++) {
+    worker_t *victim = &pool->worker[rand_r(&worker->seed) % pool->num_worker];
+    
+    if (victim == worker)
+      continue;
+    
+    vm_t *vm = deque_steal(&victim->deque);
+    
+    if (vm && vm != DEQUE_ABORT) {
+      worker->num_steal++;
+      return vm;
+    }
+  }
+  
+  return NULL;
+}
+
+static vm_t *take(worker_t *worker)
+{
+  vm_t *vm;
+  
+  do {
+    vm = deque_steal(&worker->deque);
+  } while (vm == DEQUE_ABORT);
+  
+  return vm;
+}
+
+static void *worker_main(void *arg)
+{
+  worker_t *worker = arg;
+  pool_t *pool = worker->pool;
+  
+  self = worker;
+  
+  while (atomic_load_explicit(&pool->num_task, memory_order_acquire) > 0) {
+    vm_t *vm = take(worker);
+    
+    if (!vm)
+      vm = steal(worker);
+    
+    if (!vm) {
+      park(pool);
+      continue;
+    }
+    
+    claim(pool);
+    worker->num_run++;
+    
+    vm_status_t status = vm_exec(vm, pool->slice);
+    
+    switch (status) {
+    case VM_EXIT:
+    case VM_FUEL:
+      proc_finish(vm, status);
+      if (atomic_fetch_sub(&pool->num_task, 1) == 1)
+        wake(pool, 1);
+      break;
+    case VM_YIELD:
+    case VM_BLOCK:
+      push(worker, vm);
+      break;
+    case VM_WAIT:
+      push(worker, vm);
+      sched_yield();
+      break;
+    }
+  }
+  
+  self = NULL;
+  
+  return NULL;
+}
+
+void pool_run(pool_t *pool)
+{
+  for (int i = 0; i < pool->num_worker; i++) {
+    if (pthread_create(&pool->worker[i].thread, NULL, worker_main, &pool->worker[i]))
+      error("pthread_create: failed to start worker %i", i);
+  }
+  
+  for (int i = 0; i < pool->num_worker; i++)
+    pthread_join(pool->worker[i].thread, NULL);
+}
+
+void pool_dump(pool_t *pool)
+{
+  for (int i = 0; i < pool->num_worker; i++) {
+    worker_t *worker = &pool->worker[i];
+    fprintf(stderr, "worker %i: %li slices, %li steals\n", i, worker->num_run, worker->num_steal);
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "vm.h"
+#include "../common/deque.h"
+#include <pthread.h>
+
+#define POOL_SLICE 10000
+#define POOL_DEQUE 64
+
+typedef struct pool_s pool_t;
+typedef struct worker_s worker_t;
+
+struct worker_s {
+  deque_t deque;
+  pool_t *pool;
+  pthread_t thread;
+  unsigned int seed;
+  long num_run;
+  long num_steal;
+};
+
+struct pool_s {
+  worker_t *worker;
+  int num_worker;
+  int next_worker;
+  int slice;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  _Alignas(CACHE_LINE) atomic_int num_task;
+  _Alignas(CACHE_LINE) atomic_int num_ready;
+  atomic_int num_sleep;
+};
+
+pool_t *make_pool(int num_worker, int slice);
+void free_pool(pool_t *pool);
+void pool_add(pool_t *pool, vm_t *vm);
+int pool_submit(vm_t *vm);
+void pool_run(pool_t *pool);
+void pool_dump(pool_t *pool);
+
+#endif
@@ -0,0 +1,213 @@
+#include "vm.h"
+#include "pool.h"
+
+#include "../common/error.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sched.h>
+
+proc_t *make_proc()
+{
+  proc_t *proc = malloc(sizeof(proc_t));
+  proc->bin = NULL;
+  proc->verify.func = NULL;
+  proc->mem = mem_reserve();
+  proc->num_region = 0;
+  io_init(&proc->io, 0, 1);
+  memset(proc->thread, 0, sizeof(proc->thread));
+  proc->par = NULL;
+  heap_init(&proc->heap);
+  chan_tbl_init(&proc->chan);
+  atomic_init(&proc->num_thread, 1);
+  atomic_init(&proc->budget, -1);
+  atomic_init(&proc->f_spent, 0);
+  pthread_mutex_init(&proc->lock, NULL);
+  pthread_mutex_init(&proc->par_lock, NULL);
+  pthread_cond_init(&proc->cond, NULL);
+  return proc;
+}
+
+void free_proc(proc_t *proc)
+{
+  io_free(&proc->io);
+  mem_release(proc->mem);
+  free(proc->verify.func);
+  heap_destroy(&proc->heap);
+  chan_tbl_destroy(&proc->chan);
+  pthread_mutex_destroy(&proc->lock);
+  pthread_mutex_destroy(&proc->par_lock);
+  pthread_cond_destroy(&proc->cond);
+  free(proc);
+}
+
+int proc_lock(proc_t *proc)
+{
+  if (atomic_load_explicit(&proc->num_thread, memory_order_acquire) == 1)
+    return 0;
+  
+  pthread_mutex_lock(&proc->lock);
+  
+  return 1;
+}
+
+void proc_unlock(proc_t *proc, int locked)
+{
+  if (locked)
+    pthread_mutex_unlock(&proc->lock);
+}
+
+void proc_finish(vm_t *vm, vm_status_t status)
+{
+  proc_t *proc = vm->proc;
+  thread_t *thread = vm->thread;
+  
+  int result = status == VM_EXIT && vm->sp > 0 ? vm->s_i32[vm->sp - 1] : 0;
+  
+  free_vm(vm);
+  
+  if (!thread)
+    return;
+  
+  pthread_mutex_lock(&proc->lock);
+  thread->vm = NULL;
+  thread->result = result;
+  thread->f_done = 1;
+  pthread_cond_broadcast(&proc->cond);
+  pthread_mutex_unlock(&proc->lock);
+}
+
+static void *thread_main(void *arg)
+{
+  thread_t *thread = arg;
+  vm_t *vm = thread->vm;
+  
+  vm_status_t status;
+  while ((status = vm_exec(vm, INT_MAX)) != VM_EXIT && status != VM_FUEL) {
+    if (status == VM_WAIT)
+      sched_yield();
+  }
+  
+  proc_finish(vm, status);
+  
+  return NULL;
+}
+
+int proc_spawn(vm_t *vm, int entry, int arg)
+{
+  proc_t *proc = vm->proc;
+  
+  vfunc_t *func = verify_find(&proc->verify, entry);
+  if (!func || entry == 0)
+    error("spawn: %i is not a function", entry);
+  
+  if (func->min_stack < -1)
+    error("spawn: function at %i takes more than one argument", entry);
+  
+  vm_t *child = make_thread_vm(vm, func, 1);
+  child->s_i32[child->sp++] = arg;
+  
+  pthread_mutex_lock(&proc->lock);
+  
+  int handle;
+  for (handle = 0; handle < MAX_THREAD; handle++) {
+    if (!proc->thread[handle].f_used)
+      break;
+  }
+  
+  if (handle == MAX_THREAD)
+    error("spawn: too many threads");
+  
+  thread_t *thread = &proc->thread[handle];
+  thread->vm = child;
+  thread->f_used = 1;
+  thread->f_done = 0;
+  thread->result = 0;
+  child->thread = thread;
+  
+  atomic_fetch_add_explicit(&proc->num_thread, 1, memory_order_release);
+  
+  thread->f_pool = pool_submit(child);
+  
+  if (!thread->f_pool && pthread_create(&thread->handle, NULL, thread_main, thread))
+    error("spawn: pthread_create failed");
+  
+  pthread_mutex_unlock(&proc->lock);
+  
+  return handle;
+}
+
+static thread_t *find_thread(proc_t *proc, int handle)
+{
+  if (handle < 0 || handle >= MAX_THREAD || !proc->thread[handle].f_used)
+    error("join: invalid thread %i", handle);
+  
+  return &proc->thread[handle];
+}
+
+int proc_is_done(proc_t *proc, int handle)
+{
+  pthread_mutex_lock(&proc->lock);
+  int f_done = find_thread(proc, handle)->f_done;
+  pthread_mutex_unlock(&proc->lock);
+  
+  return f_done;
+}
+
+int proc_all_done(proc_t *proc)
+{
+  pthread_mutex_lock(&proc->lock);
+  
+  int f_done = 1;
+  for (int i = 0; i < MAX_THREAD; i++) {
+    if (proc->thread[i].f_used && !proc->thread[i].f_done)
+      f_done = 0;
+  }
+  
+  pthread_mutex_unlock(&proc->lock);
+  
+  return f_done;
+}
+
+int proc_join(proc_t *proc, int handle)
+{
+  pthread_mutex_lock(&proc->lock);
+  
+  thread_t *thread = find_thread(proc, handle);
+  
+  while (!thread->f_done)
+    pthread_cond_wait(&proc->cond, &proc->lock);
+  
+  int result = thread->result;
+  pthread_t tid = thread->handle;
+  int f_pool = thread->f_pool;
+  thread->f_used = 0;
+  
+  pthread_mutex_unlock(&proc->lock);
+  
+  if (!f_pool)
+    pthread_join(tid, NULL);
+  
+  return result;
+}
+
+void proc_join_all(proc_t *proc)
+{
+  int num_joined = 1;
+  
+  while (num_joined > 0) {
+    num_joined = 0;
+    
+    for (int i = 0; i < MAX_THREAD; i++) {
+      pthread_mutex_lock(&proc->lock);
+      int f_used = proc->thread[i].f_used;
+      pthread_mutex_unlock(&proc->lock);
+      
+      if (f_used) {
+        proc_join(proc, i);
+        num_joined++;
+      }
+    }
+  }
+}
@@ -0,0 +1,119 @@
+#include "sched.h"
+
+#include "../common/error.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+
+sched_t *make_sched(int slice)
+{
+  sched_t *sched = malloc(sizeof(sched_t));
+  sched->ready = NULL;
+  sched->ready_tail = NULL;
+  sched->blocked = NULL;
+  sched->num_ready = 0;
+  sched->num_blocked = 0;
+  sched->slice = slice;
+  return sched;
+}
+
+void sched_add(sched_t *sched, vm_t *vm)
+{
+  vm->f_nonblock = 1;
+  vm->next = NULL;
+  
+  if (sched->ready)
+    sched->ready_tail = sched->ready_tail->next = vm;
+  else
+    sched->ready = sched->ready_tail = vm;
+  
+  sched->num_ready++;
+}
+
+static vm_t *sched_next(sched_t *sched)
+{
+  vm_t *vm = sched->ready;
+  
+  sched->ready = vm->next;
+  sched->num_ready--;
+  
+  return vm;
+}
+
+static void sched_block(sched_t *sched, vm_t *vm)
+{
+  vm->next = sched->blocked;
+  sched->blocked = vm;
+  sched->num_blocked++;
+}
+
+static void sched_wake(sched_t *sched, int timeout)
+{
+  struct pollfd *pfd = malloc(sched->num_blocked * sizeof(struct pollfd));
+  
+  int i = 0;
+  for (vm_t *vm = sched->blocked; vm; vm = vm->next) {
+    pfd[i].fd = vm->proc->io.fd_in;
+    pfd[i].events = POLLIN;
+    pfd[i].revents = 0;
+    i++;
+  }
+  
+  if (poll(pfd, sched->num_blocked, timeout) < 0 && errno != EINTR)
+    error("poll: %s", strerror(errno));
+  
+  vm_t **link = &sched->blocked;
+  
+  i = 0;
+  while (*link) {
+    vm_t *vm = *link;
+    
+    if (pfd[i++].revents) {
+      *link = vm->next;
+      sched->num_blocked--;
+      sched_add(sched, vm);
+    } else {
+      link = &vm->next;
+    }
+  }
+  
+  free(pfd);
+}
+
+void sched_run(sched_t *sched)
+{
+  int num_dispatch = 0;
+  
+  while (sched->num_ready || sched->num_blocked) {
+    if (!sched->num_ready)
+      sched_wake(sched, -1);
+    else if (sched->num_blocked && ++num_dispatch % SCHED_POLL == 0)
+      sched_wake(sched, 0);
+    
+    if (!sched->num_ready)
+      continue;
+    
+    vm_t *vm = sched_next(sched);
+    
+    switch (vm_exec(vm, sched->slice)) {
+    case VM_EXIT:
+    case VM_FUEL:
+      free_vm(vm);
+      break;
+    case VM_YIELD:
+      sched_add(sched, vm);
+      break;
+    case VM_BLOCK:
+      sched_block(sched, vm);
+      break;
+    case VM_WAIT:
+      sched_add(sched, vm);
+      if (sched->num_ready == 1)
+        sched_yield();
+      break;
+    }
+  }
+}
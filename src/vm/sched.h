@@ -0,0 +1,24 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "vm.h"
+
+#define SCHED_SLICE 1000
+#define SCHED_POLL 64
+
+typedef struct sched_s sched_t;
+
+struct sched_s {
+  vm_t *ready;
+  vm_t *ready_tail;
+  vm_t *blocked;
+  int num_ready;
+  int num_blocked;
+  int slice;
+};
+
+sched_t *make_sched(int slice);
+void sched_add(sched_t *sched, vm_t *vm);
+void sched_run(sched_t *sched);
+
+#endif
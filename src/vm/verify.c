@@ -0,0 +1,530 @@
+#include "verify.h"
+
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <limits.h>
+
+typedef struct effect_s effect_t;
+typedef struct site_s site_t;
+typedef struct vinfo_s vinfo_t;
+typedef struct vpath_s vpath_t;
+
+struct effect_s {
+  int pop;
+  int push;
+};
+
+struct site_s {
+  int func;
+  int stack;
+  int frame;
+  site_t *next;
+};
+
+struct vinfo_s {
+  int lo;
+  int hi;
+  int frame_hi;
+  int f_resolved;
+  int visit;
+  site_t *sites;
+};
+
+struct vpath_s {
+  int ip;
+  int stack;
+  int frame;
+};
+
+static effect_t sys_effect[MAX_SYS] = {
+  [SYS_EXIT]          = { 0, 0 },
+  [SYS_PRINT]         = { 1, 0 },
+  [SYS_WRITE]         = { 1, 0 },
+  [SYS_FLUSH]         = { 0, 0 },
+  [SYS_READ]          = { 2, 1 },
+  [SYS_READ_I32]      = { 1, 1 },
+  [SYS_READ_LINE]     = { 2, 1 },
+  [SYS_MMAP]          = { 3, 1 },
+  [SYS_MUNMAP]        = { 1, 1 },
+  [SYS_SPAWN]         = { 2, 1 },
+  [SYS_JOIN]          = { 1, 1 },
+  [SYS_CHAN]          = { 3, 1 },
+  [SYS_SEND]          = { 3, 1 },
+  [SYS_RECV]          = { 3, 1 },
+  [SYS_CLOSE]         = { 1, 0 },
+  [SYS_PARFOR]        = { 4, 1 },
+  [SYS_ALLOC]         = { 1, 1 },
+  [SYS_FREE]          = { 1, 0 },
+  [SYS_REALLOC]       = { 2, 1 },
+  [SYS_REGION_NEW]    = { 0, 1 },
+  [SYS_REGION_ALLOC]  = { 2, 1 },
+  [SYS_REGION_FREE]   = { 1, 0 }
+};
+
+static bin_t *v_bin;
+static verify_t *v_out;
+static vinfo_t *v_info;
+
+static char *is_start;
+static int *stamp;
+static int *s_depth;
+static int *f_depth;
+static vpath_t *path_stack;
+static int cur_stamp;
+
+static int verify_error(int ip, const char *fmt, ...)
+{
+  fprintf(stderr, "verify:%03i: ", ip);
+  
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  
+  fprintf(stderr, "\n");
+  
+  return 0;
+}
+
+static int is_branch(instr_t instr)
+{
+  switch (instr) {
+  case CALL:
+  case JMP:
+  case JE:
+  case JNE:
+  case JL:
+  case JG:
+  case JLE:
+  case JGE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static effect_t op_effect(instr_t instr, int arg)
+{
+  effect_t effect = { 0, 0 };
+  
+  switch (instr) {
+  case PUSH:
+  case LBP:
+  case SETE:
+  case SETNE:
+  case SETL:
+  case SETG:
+  case SETLE:
+  case SETGE:
+    effect.push = 1;
+    break;
+  case ADD:
+  case SUB:
+  case MUL:
+  case DIV:
+  case MOD:
+    effect.pop = 2;
+    effect.push = 1;
+    break;
+  case LDR:
+  case LDR8:
+  case SX8_32:
+  case SX32_8:
+    effect.pop = 1;
+    effect.push = 1;
+    break;
+  case STR:
+  case STR8:
+  case CMP:
+    effect.pop = 2;
+    break;
+  case XCHG:
+  case FADD:
+    effect.pop = 2;
+    effect.push = 1;
+    break;
+  case CAS:
+    effect.pop = 3;
+    effect.push = 1;
+    break;
+  case POP:
+    effect.pop = 1;
+    break;
+  case INT:
+    effect = sys_effect[arg];
+    break;
+  case NCALL:
+    effect.pop = native_tbl[arg].num_params;
+    effect.push = native_tbl[arg].ret;
+    break;
+  default:
+    break;
+  }
+  
+  return effect;
+}
+
+static int decode()
+{
+  for (int ip = 0; ip < v_bin->num_instr; ) {
+    instr_t instr = v_bin->instr[ip];
+    
+    if ((int) instr < 0 || (int) instr >= num_instr_tbl)
+      return verify_error(ip, "unknown op %i", instr);
+    
+    if (ip + instr_size(instr) > v_bin->num_instr)
+      return verify_error(ip, "missing operand");
+    
+    is_start[ip] = 1;
+    ip += instr_size(instr);
+  }
+  
+  for (int ip = 0; ip < v_bin->num_instr; ip += instr_size(v_bin->instr[ip])) {
+    instr_t instr = v_bin->instr[ip];
+    int arg = v_bin->instr[ip + 1];
+    
+    if (is_branch(instr) && (arg < 0 || arg >= v_bin->num_instr || !is_start[arg]))
+      return verify_error(ip, "%s to %i is not an instruction", instr_tbl[instr], arg);
+    
+    if (instr == INT && (arg < 0 || arg >= MAX_SYS))
+      return verify_error(ip, "unknown interrupt %i", arg);
+    
+    if (instr == NCALL && (arg < 0 || arg >= num_native_tbl))
+      return verify_error(ip, "unknown native %i", arg);
+  }
+  
+  return 1;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+  return ((vfunc_t*) a)->entry - ((vfunc_t*) b)->entry;
+}
+
+static void find_entries()
+{
+  v_out->func = malloc((v_bin->num_instr + 1) * sizeof(vfunc_t));
+  v_out->num_func = 0;
+  
+  v_out->func[v_out->num_func++].entry = 0;
+  
+  for (int ip = 0; ip < v_bin->num_instr; ip += instr_size(v_bin->instr[ip])) {
+    switch (v_bin->instr[ip]) {
+    case CALL:
+      v_out->func[v_out->num_func++].entry = v_bin->instr[ip + 1];
+      break;
+    case ENTER:
+      v_out->func[v_out->num_func++].entry = ip;
+      break;
+    default:
+      break;
+    }
+  }
+  
+  qsort(v_out->func, v_out->num_func, sizeof(vfunc_t), cmp_entry);
+  
+  int num_func = 0;
+  for (int i = 0; i < v_out->num_func; i++) {
+    if (!num_func || v_out->func[num_func - 1].entry != v_out->func[i].entry)
+      v_out->func[num_func++].entry = v_out->func[i].entry;
+  }
+  
+  v_out->num_func = num_func;
+  v_out->func = realloc(v_out->func, num_func * sizeof(vfunc_t));
+  
+  for (int i = 0; i < num_func; i++) {
+    v_out->func[i].f_ret = 0;
+    v_out->func[i].effect = 0;
+  }
+}
+
+vfunc_t *verify_find(verify_t *verify, int entry)
+{
+  int lo = 0, hi = verify->num_func - 1;
+  
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    
+    if (verify->func[mid].entry == entry)
+      return &verify->func[mid];
+    else if (verify->func[mid].entry < entry)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  
+  return NULL;
+}
+
+static void add_site(vinfo_t *info, int func, int stack, int frame)
+{
+  site_t *site = malloc(sizeof(site_t));
+  site->func = func;
+  site->stack = stack;
+  site->frame = frame;
+  site->next = info->sites;
+  info->sites = site;
+}
+
+static int analyze(int fi, int f_final)
+{
+  vfunc_t *func = &v_out->func[fi];
+  vinfo_t *info = &v_info[fi];
+  
+  info->lo = 0;
+  info->hi = 0;
+  info->frame_hi = 0;
+  
+  cur_stamp++;
+  
+  int num_path = 0;
+  path_stack[num_path++] = (vpath_t) { func->entry, 0, 0 };
+  
+  while (num_path > 0) {
+    vpath_t path = path_stack[--num_path];
+    
+    int ip = path.ip;
+    int stack = path.stack;
+    int frame = path.frame;
+    
+    while (1) {
+      if (ip >= v_bin->num_instr)
+        return verify_error(ip, "execution falls off the end of the code");
+      
+      if (stamp[ip] == cur_stamp) {
+        if (s_depth[ip] != stack || f_depth[ip] != frame)
+          return verify_error(ip, "stack depth %i/%i does not match %i/%i", stack, frame, s_depth[ip], f_depth[ip]);
+        break;
+      }
+      
+      stamp[ip] = cur_stamp;
+      s_depth[ip] = stack;
+      f_depth[ip] = frame;
+      
+      instr_t instr = v_bin->instr[ip];
+      int arg = instr_size(instr) == 2 ? v_bin->instr[ip + 1] : 0;
+      int next = ip + instr_size(instr);
+      
+      if (instr == JMP) {
+        ip = arg;
+        continue;
+      } else if (is_branch(instr) && instr != CALL) {
+        path_stack[num_path++] = (vpath_t) { arg, stack, frame };
+      } else if (instr == CALL) {
+        vfunc_t *callee = verify_find(v_out, arg);
+        int gi = callee - v_out->func;
+        
+        if (f_final)
+          add_site(info, gi, stack, frame);
+        
+        if (!callee->f_ret)
+          break;
+        
+        stack += callee->effect;
+      } else if (instr == RET) {
+        if (func->entry == 0)
+          return verify_error(ip, "ret outside of a function");
+        
+        if (frame != 0)
+          return verify_error(ip, "ret with %i frames entered", frame);
+        
+        if (func->f_ret && func->effect != stack)
+          return verify_error(ip, "ret at stack depth %i, expected %i", stack, func->effect);
+        
+        func->f_ret = 1;
+        func->effect = stack;
+        break;
+      } else if (instr == INT && arg == SYS_EXIT) {
+        break;
+      } else if (instr == ENTER) {
+        frame++;
+      } else if (instr == LEAVE) {
+        if (--frame < 0)
+          return verify_error(ip, "leave without enter");
+      }
+      
+      effect_t effect = op_effect(instr, arg);
+      stack -= effect.pop;
+      
+      if (stack < info->lo)
+        info->lo = stack;
+      
+      stack += effect.push;
+      
+      if (stack > info->hi)
+        info->hi = stack;
+      
+      if (frame > info->frame_hi)
+        info->frame_hi = frame;
+      
+      ip = next;
+    }
+  }
+  
+  return 1;
+}
+
+static void aggregate(int fi)
+{
+  vfunc_t *func = &v_out->func[fi];
+  vinfo_t *info = &v_info[fi];
+  
+  info->visit = 1;
+  
+  func->min_stack = info->lo;
+  func->max_stack = info->hi;
+  func->max_call = 0;
+  func->max_frame = info->frame_hi;
+  
+  for (site_t *site = info->sites; site; site = site->next) {
+    vfunc_t *callee = &v_out->func[site->func];
+    
+    if (v_info[site->func].visit == 1) {
+      v_out->bounded = 0;
+      
+      if (site->stack + v_info[site->func].lo < func->min_stack)
+        func->min_stack = site->stack + v_info[site->func].lo;
+      
+      continue;
+    }
+    
+    if (!v_info[site->func].visit)
+      aggregate(site->func);
+    
+    if (site->stack + callee->min_stack < func->min_stack)
+      func->min_stack = site->stack + callee->min_stack;
+    
+    if (site->stack + callee->max_stack > func->max_stack)
+      func->max_stack = site->stack + callee->max_stack;
+    
+    if (callee->max_call + 1 > func->max_call)
+      func->max_call = callee->max_call + 1;
+    
+    if (site->frame + callee->max_frame > func->max_frame)
+      func->max_frame = site->frame + callee->max_frame;
+  }
+  
+  info->visit = 2;
+}
+
+static int run_verify()
+{
+  if (!decode())
+    return 0;
+  
+  find_entries();
+  
+  v_info = calloc(v_out->num_func, sizeof(vinfo_t));
+  
+  int progress = 1;
+  while (progress) {
+    progress = 0;
+    
+    for (int i = 0; i < v_out->num_func; i++) {
+      if (v_info[i].f_resolved)
+        continue;
+      
+      if (!analyze(i, 0))
+        return 0;
+      
+      if (v_out->func[i].f_ret) {
+        v_info[i].f_resolved = 1;
+        progress = 1;
+      }
+    }
+  }
+  
+  for (int i = 0; i < v_out->num_func; i++) {
+    if (!analyze(i, 1))
+      return 0;
+  }
+  
+  v_out->bounded = 1;
+  
+  for (int i = 0; i < v_out->num_func; i++) {
+    if (!v_info[i].visit)
+      aggregate(i);
+  }
+  
+  vfunc_t *main_func = &v_out->func[0];
+  
+  if (main_func->min_stack < 0)
+    return verify_error(0, "operand stack underflow by %i", -main_func->min_stack);
+  
+  if (v_out->bounded) {
+    v_out->max_stack = main_func->max_stack;
+    v_out->max_call = main_func->max_call;
+    v_out->max_frame = main_func->max_frame;
+  } else {
+    int stack_hi = 0, frame_hi = 0;
+    for (int i = 0; i < v_out->num_func; i++) {
+      if (v_info[i].hi > stack_hi)
+        stack_hi = v_info[i].hi;
+      if (v_info[i].frame_hi > frame_hi)
+        frame_hi = v_info[i].frame_hi;
+    }
+    
+    v_out->max_call = MAX_CALL;
+    v_out->max_stack = v_info[0].hi + MAX_CALL * stack_hi;
+    v_out->max_frame = v_info[0].frame_hi + MAX_CALL * frame_hi;
+  }
+  
+  return 1;
+}
+
+int vm_verify(bin_t *bin, verify_t *verify)
+{
+  v_bin = bin;
+  v_out = verify;
+  v_out->func = NULL;
+  v_info = NULL;
+  
+  is_start = calloc(bin->num_instr + 1, 1);
+  stamp = calloc(bin->num_instr + 1, sizeof(int));
+  s_depth = malloc((bin->num_instr + 1) * sizeof(int));
+  f_depth = malloc((bin->num_instr + 1) * sizeof(int));
+  path_stack = malloc((bin->num_instr + 1) * sizeof(vpath_t));
+  cur_stamp = 0;
+  
+  int ok = run_verify();
+  
+  if (v_info) {
+    for (int i = 0; i < v_out->num_func; i++) {
+      site_t *site = v_info[i].sites;
+      while (site) {
+        site_t *next = site->next;
+        free(site);
+        site = next;
+      }
+    }
+    free(v_info);
+  }
+  
+  free(is_start);
+  free(stamp);
+  free(s_depth);
+  free(f_depth);
+  free(path_stack);
+  
+  return ok;
+}
+
+void verify_dump(verify_t *verify)
+{
+  printf("verify: %s stack %i call %i frame %i\n",
+    verify->bounded ? "bounded" : "recursive",
+    verify->max_stack, verify->max_call, verify->max_frame);
+  
+  for (int i = 0; i < verify->num_func; i++) {
+    vfunc_t *func = &verify->func[i];
+    
+    if (func->f_ret)
+      printf("%03i effect %i", func->entry, func->effect);
+    else
+      printf("%03i noreturn", func->entry);
+    
+    printf(" stack %i call %i frame %i\n", func->max_stack, func->max_call, func->max_frame);
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "bin.h"
+
+typedef struct verify_s verify_t;
+typedef struct vfunc_s vfunc_t;
+
+struct vfunc_s {
+  int entry;
+  int f_ret;
+  int effect;
+  int min_stack;
+  int max_stack;
+  int max_call;
+  int max_frame;
+};
+
+struct verify_s {
+  int bounded;
+  int max_stack;
+  int max_call;
+  int max_frame;
+  vfunc_t *func;
+  int num_func;
+};
+
+int vm_verify(bin_t *bin, verify_t *verify);
+vfunc_t *verify_find(verify_t *verify, int entry);
+void verify_dump(verify_t *verify);
+
+#endif
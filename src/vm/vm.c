@@ -1,4 +1,5 @@
 #include "vm.h"
+#include "par.h"
 
 #include "../common/error.h"
 #include <stdio.h>
@@ -7,24 +8,124 @@
 
 #define ALIGN_32(X) (X / 4)
 
-vm_t *make_vm()
+static vm_t *alloc_vm(proc_t *proc)
 {
   vm_t *vm = malloc(sizeof(vm_t));
   vm->ip = 0;
   vm->sp = 0;
-  vm->bp = MAX_MEM * sizeof(int);
+  vm->bp = MAX_MEM;
   vm->cp = 0;
   vm->fp = 0;
   vm->f_gtr = 0;
   vm->f_lss = 0;
   vm->f_equ = 0;
   vm->f_exit = 0;
+  vm->f_block = 0;
+  vm->f_wait = 0;
+  vm->f_nonblock = 0;
+  vm->f_main = 0;
+  vm->f_par = 0;
+  vm->f_stop = 0;
+  vm->fuel = 0;
+  vm->next = NULL;
+  vm->stack = NULL;
+  vm->call = NULL;
+  vm->frame = NULL;
+  vm->stack_size = 0;
+  vm->call_size = 0;
+  vm->frame_size = 0;
+  vm->s_i32 = NULL;
+  vm->proc = proc;
+  vm->thread = NULL;
+  vm->stack_addr = -1;
+  vm->bin = proc->bin;
+  vm->m_i8 = proc->mem;
+  vm->m_i32 = (int*) proc->mem;
+  return vm;
+}
+
+static void alloc_stacks(vm_t *vm, int max_stack, int max_call, int max_frame)
+{
+  free(vm->stack);
+  free(vm->call);
+  free(vm->frame);
+  
+  vm->stack = malloc((max_stack + 1) * sizeof(int));
+  vm->call = malloc((max_call + 1) * sizeof(int));
+  vm->frame = malloc((max_frame + 1) * sizeof(int));
+  vm->stack_size = max_stack;
+  vm->call_size = max_call;
+  vm->frame_size = max_frame;
   vm->s_i32 = vm->stack;
-  vm->m_i8 = (char*) vm->mem;
-  vm->m_i32 = vm->mem;
+}
+
+static void grow_stacks(vm_t *vm, int max_stack, int max_call, int max_frame)
+{
+  if (max_call > vm->call_size && max_call > MAX_CALL)
+    error("call stack overflow");
+  
+  if (max_stack > vm->stack_size) {
+    vm->stack = realloc(vm->stack, (max_stack + 1) * sizeof(int));
+    vm->stack_size = max_stack;
+    vm->s_i32 = vm->stack;
+  }
+  
+  if (max_call > vm->call_size) {
+    vm->call = realloc(vm->call, (max_call + 1) * sizeof(int));
+    vm->call_size = max_call;
+  }
+  
+  if (max_frame > vm->frame_size) {
+    vm->frame = realloc(vm->frame, (max_frame + 1) * sizeof(int));
+    vm->frame_size = max_frame;
+  }
+}
+
+vm_t *make_vm()
+{
+  vm_t *vm = alloc_vm(make_proc());
+  vm->f_main = 1;
   return vm;
 }
 
+vm_t *make_thread_vm(vm_t *parent, vfunc_t *func, int depth)
+{
+  proc_t *proc = parent->proc;
+  verify_t *verify = &proc->verify;
+  
+  vm_t *vm = alloc_vm(proc);
+  
+  if (verify->bounded)
+    alloc_stacks(vm, func->max_stack + depth, func->max_call, func->max_frame);
+  else
+    alloc_stacks(vm, verify->max_stack + depth, verify->max_call, verify->max_frame);
+  
+  vm->stack_addr = mem_map_stack(parent, THREAD_STACK);
+  if (vm->stack_addr < 0)
+    error("could not map thread stack");
+  
+  vm->ip = func->entry;
+  vm->bp = vm->stack_addr + THREAD_STACK;
+  
+  return vm;
+}
+
+void free_vm(vm_t *vm)
+{
+  proc_t *proc = vm->proc;
+  
+  if (vm->stack_addr >= 0)
+    mem_unmap_stack(vm, vm->stack_addr);
+  
+  free(vm->stack);
+  free(vm->call);
+  free(vm->frame);
+  free(vm);
+  
+  if (atomic_fetch_sub_explicit(&proc->num_thread, 1, memory_order_acq_rel) == 1)
+    free_proc(proc);
+}
+
 instr_t fetch(vm_t *vm)
 {
   return vm->bin->instr[vm->ip++];
@@ -86,6 +187,41 @@ static inline void vm_str8(vm_t *vm)
   vm->sp -= 2;
 }
 
+static inline void vm_pop(vm_t *vm)
+{
+  --vm->sp;
+}
+
+static inline void vm_xchg(vm_t *vm)
+{
+  int *ptr = &vm->m_i32[ALIGN_32(vm->s_i32[vm->sp - 2])];
+  vm->s_i32[vm->sp - 2] = __atomic_exchange_n(ptr, vm->s_i32[vm->sp - 1], __ATOMIC_SEQ_CST);
+  --vm->sp;
+}
+
+static inline void vm_cas(vm_t *vm)
+{
+  int *ptr = &vm->m_i32[ALIGN_32(vm->s_i32[vm->sp - 3])];
+  int expected = vm->s_i32[vm->sp - 2];
+  
+  __atomic_compare_exchange_n(ptr, &expected, vm->s_i32[vm->sp - 1], 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  
+  vm->s_i32[vm->sp - 3] = expected;
+  vm->sp -= 2;
+}
+
+static inline void vm_fadd(vm_t *vm)
+{
+  int *ptr = &vm->m_i32[ALIGN_32(vm->s_i32[vm->sp - 2])];
+  vm->s_i32[vm->sp - 2] = __atomic_fetch_add(ptr, vm->s_i32[vm->sp - 1], __ATOMIC_SEQ_CST);
+  --vm->sp;
+}
+
+static inline void vm_fence()
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
 static inline void vm_lbp(vm_t *vm)
 {
   vm->s_i32[vm->sp++] = vm->bp;
@@ -104,17 +240,30 @@ static inline void vm_leave(vm_t *vm)
 
 static inline void vm_call(vm_t *vm, int i32)
 {
+  if (vm->cp == vm->call_size)
+    error("call stack overflow");
+  
   vm->call[vm->cp++] = vm->ip;
   vm->ip = i32;
+  vm->fuel--;
 }
 
 static inline void vm_ret(vm_t *vm)
 {
+  if (!vm->cp) {
+    vm->f_exit = 1;
+    vm->f_stop = 1;
+    return;
+  }
+  
   vm->ip = vm->call[--vm->cp];
 }
 
 static inline void vm_jmp(vm_t *vm, int i32)
 {
+  if (i32 < vm->ip)
+    vm->fuel--;
+  
   vm->ip = i32;
 }
 
@@ -131,37 +280,37 @@ static inline void vm_cmp(vm_t *vm)
 static inline void vm_je(vm_t *vm, int i32)
 {
   if (vm->f_equ)
-    vm->ip = i32;
+    vm_jmp(vm, i32);
 }
 
 static inline void vm_jne(vm_t *vm, int i32)
 {
   if (!vm->f_equ)
-    vm->ip = i32;
+    vm_jmp(vm, i32);
 }
 
 static inline void vm_jl(vm_t *vm, int i32)
 {
   if (vm->f_lss)
-    vm->ip = i32;
+    vm_jmp(vm, i32);
 }
 
 static inline void vm_jg(vm_t *vm, int i32)
 {
   if (vm->f_gtr)
-    vm->ip = i32;
+    vm_jmp(vm, i32);
 }
 
 static inline void vm_jle(vm_t *vm, int i32)
 {
   if (vm->f_equ || vm->f_lss)
-    vm->ip = i32;
+    vm_jmp(vm, i32);
 }
 
 static inline void vm_jge(vm_t *vm, int i32)
 {
   if (vm->f_equ || vm->f_gtr)
-    vm->ip = i32;
+    vm_jmp(vm, i32);
 }
 
 static inline void vm_sete(vm_t *vm)
@@ -211,20 +360,353 @@ static inline void vm_mod(vm_t *vm)
   --vm->sp;
 }
 
+static inline void vm_retry(vm_t *vm)
+{
+  vm->ip -= 2;
+  vm->f_stop = 1;
+}
+
+static inline void vm_wait(vm_t *vm)
+{
+  vm_retry(vm);
+  vm->f_wait = 1;
+}
+
 static inline void vm_exit(vm_t *vm)
 {
+  if (vm->f_main) {
+    if (vm->f_nonblock && !proc_all_done(vm->proc)) {
+      vm_wait(vm);
+      return;
+    }
+    
+    proc_join_all(vm->proc);
+    par_stop(vm->proc);
+  }
+  
   vm->f_exit = 1;
+  vm->f_stop = 1;
+}
+
+static inline int vm_would_block(vm_t *vm)
+{
+  if (!vm->f_nonblock)
+    return 0;
+  
+  int locked = proc_lock(vm->proc);
+  int ready = io_in_ready(&vm->proc->io);
+  proc_unlock(vm->proc, locked);
+  
+  if (ready)
+    return 0;
+  
+  vm_retry(vm);
+  vm->f_block = 1;
+  
+  return 1;
 }
 
 static inline void vm_print(vm_t *vm)
 {
-  printf("%i\n", vm->s_i32[vm->sp - 1]);
+  int locked = proc_lock(vm->proc);
+  io_put_i32(&vm->proc->io, vm->s_i32[vm->sp - 1]);
+  proc_unlock(vm->proc, locked);
+  
   vm->sp -= 1;
 }
 
 static inline void vm_write(vm_t *vm)
 {
-  fputs(&vm->m_i8[vm->s_i32[vm->sp - 1]], stdout);
+  int locked = proc_lock(vm->proc);
+  io_put_str(&vm->proc->io, &vm->m_i8[vm->s_i32[vm->sp - 1]]);
+  proc_unlock(vm->proc, locked);
+  
+  vm->sp -= 1;
+}
+
+static inline void vm_flush(vm_t *vm)
+{
+  int locked = proc_lock(vm->proc);
+  io_flush(&vm->proc->io);
+  proc_unlock(vm->proc, locked);
+}
+
+static inline char *vm_buf(vm_t *vm, int addr, int len)
+{
+  if (!mem_is_writable(vm, addr, len))
+    error("buffer out of bounds: %i+%i", addr, len);
+  
+  return &vm->m_i8[addr];
+}
+
+static inline char *vm_cstr(vm_t *vm, int addr)
+{
+  char *str = mem_str(vm, addr);
+  if (!str)
+    error("string out of bounds: %i", addr);
+  
+  return str;
+}
+
+static inline void vm_read(vm_t *vm)
+{
+  if (vm_would_block(vm))
+    return;
+  
+  int len = vm->s_i32[vm->sp - 1];
+  char *buf = vm_buf(vm, vm->s_i32[vm->sp - 2], len);
+  
+  int locked = proc_lock(vm->proc);
+  vm->s_i32[vm->sp - 2] = io_read(&vm->proc->io, buf, len);
+  proc_unlock(vm->proc, locked);
+  
+  vm->sp -= 1;
+}
+
+static inline void vm_read_i32(vm_t *vm)
+{
+  if (vm_would_block(vm))
+    return;
+  
+  int *i32 = (int*) vm_buf(vm, vm->s_i32[vm->sp - 1], sizeof(int));
+  
+  int locked = proc_lock(vm->proc);
+  vm->s_i32[vm->sp - 1] = io_read_i32(&vm->proc->io, i32);
+  proc_unlock(vm->proc, locked);
+}
+
+static inline void vm_read_line(vm_t *vm)
+{
+  if (vm_would_block(vm))
+    return;
+  
+  int len = vm->s_i32[vm->sp - 1];
+  char *buf = vm_buf(vm, vm->s_i32[vm->sp - 2], len);
+  
+  if (len < 1)
+    error("read_line: buffer too small");
+  
+  int locked = proc_lock(vm->proc);
+  vm->s_i32[vm->sp - 2] = io_read_line(&vm->proc->io, buf, len);
+  proc_unlock(vm->proc, locked);
+  
+  vm->sp -= 1;
+}
+
+static inline void vm_mmap(vm_t *vm)
+{
+  int *size = (int*) vm_buf(vm, vm->s_i32[vm->sp - 1], sizeof(int));
+  mmap_flag_t flag = vm->s_i32[vm->sp - 2];
+  char *path = vm_cstr(vm, vm->s_i32[vm->sp - 3]);
+  
+  vm->s_i32[vm->sp - 3] = mem_map_file(vm, path, flag, size);
+  vm->sp -= 2;
+}
+
+static inline void vm_munmap(vm_t *vm)
+{
+  vm->s_i32[vm->sp - 1] = mem_unmap(vm, vm->s_i32[vm->sp - 1]);
+}
+
+static inline void vm_spawn(vm_t *vm)
+{
+  vm->s_i32[vm->sp - 2] = proc_spawn(vm, vm->s_i32[vm->sp - 2], vm->s_i32[vm->sp - 1]);
+  vm->sp -= 1;
+}
+
+static inline void vm_join(vm_t *vm)
+{
+  int handle = vm->s_i32[vm->sp - 1];
+  
+  if (vm->f_nonblock && !proc_is_done(vm->proc, handle)) {
+    vm_wait(vm);
+    return;
+  }
+  
+  vm->s_i32[vm->sp - 1] = proc_join(vm->proc, handle);
+  
+  if (atomic_load_explicit(&vm->proc->f_spent, memory_order_relaxed))
+    vm->f_stop = 1;
+}
+
+static inline int vm_is_metered(vm_t *vm)
+{
+  return vm->f_nonblock || atomic_load_explicit(&vm->proc->budget, memory_order_relaxed) >= 0;
+}
+
+static inline chan_t *vm_chan(vm_t *vm, int handle)
+{
+  chan_t *chan = chan_get(&vm->proc->chan, handle);
+  if (chan)
+    return chan;
+  
+  if (!atomic_exchange(&vm->proc->f_spent, 1)) {
+    vm_flush(vm);
+    fprintf(stderr, "invalid channel %i at ", handle);
+    bin_where(vm->bin, vm->ip, stderr);
+    fprintf(stderr, "\n");
+  }
+  
+  vm_retry(vm);
+  
+  return NULL;
+}
+
+static inline void vm_chan_new(vm_t *vm)
+{
+  int size = vm->s_i32[vm->sp - 1];
+  int cap = vm->s_i32[vm->sp - 2];
+  chan_mode_t mode = vm->s_i32[vm->sp - 3];
+  
+  vm->s_i32[vm->sp - 3] = chan_new(&vm->proc->chan, mode, cap, size);
+  vm->sp -= 2;
+}
+
+static inline void vm_send(vm_t *vm)
+{
+  int wait = vm->s_i32[vm->sp - 1];
+  chan_t *chan = vm_chan(vm, vm->s_i32[vm->sp - 3]);
+  if (!chan)
+    return;
+  
+  int addr = vm->s_i32[vm->sp - 2];
+  if (!mem_is_readable(vm, addr, chan->size))
+    error("send: buffer out of bounds: %i+%i", addr, chan->size);
+  
+  int ret = chan_send(chan, &vm->m_i8[addr]);
+  
+  if (!ret && wait) {
+    if (vm_is_metered(vm)) {
+      chan_put(&vm->proc->chan, chan);
+      vm_wait(vm);
+      return;
+    }
+    
+    ret = chan_send_wait(chan, &vm->m_i8[addr]);
+  }
+  
+  chan_put(&vm->proc->chan, chan);
+  
+  vm->s_i32[vm->sp - 3] = ret;
+  vm->sp -= 2;
+}
+
+static inline void vm_recv(vm_t *vm)
+{
+  int wait = vm->s_i32[vm->sp - 1];
+  chan_t *chan = vm_chan(vm, vm->s_i32[vm->sp - 3]);
+  if (!chan)
+    return;
+  
+  char *buf = vm_buf(vm, vm->s_i32[vm->sp - 2], chan->size);
+  
+  int ret = chan_recv(chan, buf);
+  
+  if (!ret && wait) {
+    if (vm_is_metered(vm)) {
+      chan_put(&vm->proc->chan, chan);
+      vm_wait(vm);
+      return;
+    }
+    
+    ret = chan_recv_wait(chan, buf);
+  }
+  
+  chan_put(&vm->proc->chan, chan);
+  
+  vm->s_i32[vm->sp - 3] = ret;
+  vm->sp -= 2;
+}
+
+static inline void vm_close(vm_t *vm)
+{
+  chan_t *chan = vm_chan(vm, vm->s_i32[vm->sp - 1]);
+  if (!chan)
+    return;
+  
+  chan_close(chan);
+  chan_put(&vm->proc->chan, chan);
+  vm->sp -= 1;
+}
+
+static inline void vm_par_serial(vm_t *vm)
+{
+  int *arg = &vm->s_i32[vm->sp - 4];
+  int entry = arg[0], lo = arg[1], hi = arg[2], bp = arg[3];
+  
+  verify_t *verify = &vm->proc->verify;
+  if (verify->bounded) {
+    vfunc_t *func = verify_find(verify, entry);
+    grow_stacks(vm, vm->sp + func->max_stack, vm->cp + func->max_call + 1, vm->fp + func->max_frame);
+    arg = &vm->s_i32[vm->sp - 4];
+  }
+  
+  arg[0] = lo < hi ? hi : lo;
+  arg[1] = bp;
+  arg[2] = hi;
+  arg[3] = lo;
+  
+  vm_call(vm, entry);
+}
+
+static inline void vm_parfor(vm_t *vm)
+{
+  int *arg = &vm->s_i32[vm->sp - 4];
+  
+  int done;
+  if (vm->f_nonblock)
+    done = par_step(vm, arg[0], arg[1], arg[2], arg[3]);
+  else
+    done = par_run(vm, arg[0], arg[1], arg[2], arg[3]);
+  
+  if (!done) {
+    vm_wait(vm);
+    return;
+  }
+  
+  if (done < 0) {
+    vm_par_serial(vm);
+    return;
+  }
+  
+  arg[0] = arg[1] < arg[2] ? arg[2] : arg[1];
+  vm->sp -= 3;
+  
+  if (atomic_load_explicit(&vm->proc->f_spent, memory_order_relaxed))
+    vm->f_stop = 1;
+}
+
+static inline void vm_alloc(vm_t *vm)
+{
+  vm->s_i32[vm->sp - 1] = heap_alloc(vm, vm->s_i32[vm->sp - 1]);
+}
+
+static inline void vm_free(vm_t *vm)
+{
+  heap_free(vm, vm->s_i32[vm->sp - 1]);
+  vm->sp -= 1;
+}
+
+static inline void vm_realloc(vm_t *vm)
+{
+  vm->s_i32[vm->sp - 2] = heap_realloc(vm, vm->s_i32[vm->sp - 2], vm->s_i32[vm->sp - 1]);
+  vm->sp -= 1;
+}
+
+static inline void vm_region_new(vm_t *vm)
+{
+  vm_push(vm, heap_region_new(vm));
+}
+
+static inline void vm_region_alloc(vm_t *vm)
+{
+  vm->s_i32[vm->sp - 2] = heap_region_alloc(vm, vm->s_i32[vm->sp - 2], vm->s_i32[vm->sp - 1]);
+  vm->sp -= 1;
+}
+
+static inline void vm_region_free(vm_t *vm)
+{
+  heap_region_free(vm, vm->s_i32[vm->sp - 1]);
   vm->sp -= 1;
 }
 
@@ -240,23 +722,178 @@ static inline void vm_int(vm_t *vm, int code)
   case SYS_WRITE:
     vm_write(vm);
     break;
+  case SYS_FLUSH:
+    vm_flush(vm);
+    break;
+  case SYS_READ:
+    vm_read(vm);
+    break;
+  case SYS_READ_I32:
+    vm_read_i32(vm);
+    break;
+  case SYS_READ_LINE:
+    vm_read_line(vm);
+    break;
+  case SYS_MMAP:
+    vm_mmap(vm);
+    break;
+  case SYS_MUNMAP:
+    vm_munmap(vm);
+    break;
+  case SYS_SPAWN:
+    vm_spawn(vm);
+    break;
+  case SYS_JOIN:
+    vm_join(vm);
+    break;
+  case SYS_CHAN:
+    vm_chan_new(vm);
+    break;
+  case SYS_SEND:
+    vm_send(vm);
+    break;
+  case SYS_RECV:
+    vm_recv(vm);
+    break;
+  case SYS_CLOSE:
+    vm_close(vm);
+    break;
+  case SYS_PARFOR:
+    vm_parfor(vm);
+    break;
+  case SYS_ALLOC:
+    vm_alloc(vm);
+    break;
+  case SYS_FREE:
+    vm_free(vm);
+    break;
+  case SYS_REALLOC:
+    vm_realloc(vm);
+    break;
+  case SYS_REGION_NEW:
+    vm_region_new(vm);
+    break;
+  case SYS_REGION_ALLOC:
+    vm_region_alloc(vm);
+    break;
+  case SYS_REGION_FREE:
+    vm_region_free(vm);
+    break;
   }
 }
 
+static inline void vm_ncall(vm_t *vm, int idx)
+{
+  native_t *native = &native_tbl[idx];
+  
+  vm->sp -= native->num_params;
+  int ret = native->func(vm, &vm->s_i32[vm->sp]);
+  
+  if (native->ret)
+    vm_push(vm, ret);
+}
+
 void vm_load(vm_t *vm, bin_t *bin)
 {
+  verify_t *verify = &vm->proc->verify;
+  
+  free(verify->func);
+  
+  if (bin->bss_size < 0 || bin->data_size < 0 || bin->data_size > MAX_MEM - bin->bss_size)
+    error("bytecode data does not fit in memory");
+  
+  if (!vm_verify(bin, verify))
+    error("bytecode failed verification");
+  
+  alloc_stacks(vm, verify->max_stack, verify->max_call, verify->max_frame);
+  
+  vm->proc->bin = bin;
   vm->bin = bin;
   vm->ip = 0;
-  vm->bp = MAX_MEM * sizeof(int);
+  vm->bp = MAX_MEM;
   vm->sp = 0;
   vm->f_exit = 0;
   
   memcpy(vm->m_i8 + bin->bss_size, bin->data, bin->data_size);
 }
 
-void vm_exec(vm_t *vm)
+static int vm_take_fuel(vm_t *vm, int fuel)
 {
-  while (!vm->f_exit) {
+  proc_t *proc = vm->proc;
+  
+  int budget = atomic_load_explicit(&proc->budget, memory_order_relaxed);
+  if (budget < 0)
+    return fuel;
+  
+  if (fuel > FUEL_SLICE)
+    fuel = FUEL_SLICE;
+  
+  int take;
+  do {
+    take = fuel < budget ? fuel : budget;
+  } while (!atomic_compare_exchange_weak_explicit(&proc->budget, &budget, budget - take, memory_order_relaxed, memory_order_relaxed));
+  
+  if (take == 0 && !atomic_exchange(&proc->f_spent, 1)) {
+    vm_flush(vm);
+    fprintf(stderr, "out of fuel at ");
+    bin_where(vm->bin, vm->ip, stderr);
+    fprintf(stderr, "\n");
+  }
+  
+  return atomic_load_explicit(&proc->f_spent, memory_order_relaxed) ? 0 : take;
+}
+
+static void vm_give_fuel(vm_t *vm)
+{
+  if (vm->fuel > 0 && atomic_load_explicit(&vm->proc->budget, memory_order_relaxed) >= 0)
+    atomic_fetch_add_explicit(&vm->proc->budget, vm->fuel, memory_order_relaxed);
+}
+
+static vm_status_t vm_stop(vm_t *vm)
+{
+  vm->f_stop = 0;
+  
+  vm_give_fuel(vm);
+  
+  if (vm->f_exit) {
+    vm_flush(vm);
+    return VM_EXIT;
+  }
+  
+  if (vm->f_block) {
+    vm->f_block = 0;
+    return VM_BLOCK;
+  }
+  
+  if (vm->f_wait) {
+    vm->f_wait = 0;
+    return VM_WAIT;
+  }
+  
+  if (atomic_load_explicit(&vm->proc->f_spent, memory_order_relaxed)) {
+    if (vm->f_main && vm->f_nonblock && !proc_all_done(vm->proc))
+      return VM_WAIT;
+    
+    if (vm->f_main) {
+      proc_join_all(vm->proc);
+      par_stop(vm->proc);
+    }
+    
+    vm_flush(vm);
+    return VM_FUEL;
+  }
+  
+  return VM_YIELD;
+}
+
+vm_status_t vm_exec(vm_t *vm, int fuel)
+{
+  vm->fuel = vm_take_fuel(vm, fuel);
+  
+  if (vm->fuel <= 0)
+    return vm_stop(vm);
+  
+  while (1) {
     switch (fetch(vm)) {
     case PUSH:
       vm_push(vm, fetch(vm));
@@ -296,36 +933,54 @@ void vm_exec(vm_t *vm)
       break;
     case CALL:
       vm_call(vm, fetch(vm));
+      if (vm->fuel <= 0)
+        return vm_stop(vm);
       break;
     case LEAVE:
       vm_leave(vm);
       break;
     case RET:
       vm_ret(vm);
+      if (vm->f_stop)
+        return vm_stop(vm);
       break;
     case JMP:
       vm_jmp(vm, fetch(vm));
+      if (vm->fuel <= 0)
+        return vm_stop(vm);
       break;
     case CMP:
       vm_cmp(vm);
       break;
     case JE:
       vm_je(vm, fetch(vm));
+      if (vm->fuel <= 0)
+        return vm_stop(vm);
       break;
     case JNE:
       vm_jne(vm, fetch(vm));
+      if (vm->fuel <= 0)
+        return vm_stop(vm);
       break;
     case JL:
       vm_jl(vm, fetch(vm));
+      if (vm->fuel <= 0)
+        return vm_stop(vm);
       break;
     case JG:
       vm_jg(vm, fetch(vm));
+      if (vm->fuel <= 0)
+        return vm_stop(vm);
       break;
     case JLE:
       vm_jle(vm, fetch(vm));
+      if (vm->fuel <= 0)
+        return vm_stop(vm);
       break;
     case JGE:
       vm_jge(vm, fetch(vm));
+      if (vm->fuel <= 0)
+        return vm_stop(vm);
       break;
     case SETE:
       vm_sete(vm);
@@ -353,6 +1008,26 @@ void vm_exec(vm_t *vm)
       break;
     case INT:
       vm_int(vm, fetch(vm));
+      if (vm->f_stop)
+        return vm_stop(vm);
+      break;
+    case NCALL:
+      vm_ncall(vm, fetch(vm));
+      break;
+    case POP:
+      vm_pop(vm);
+      break;
+    case XCHG:
+      vm_xchg(vm);
+      break;
+    case CAS:
+      vm_cas(vm);
+      break;
+    case FADD:
+      vm_fadd(vm);
+      break;
+    case FENCE:
+      vm_fence();
       break;
     default:
       error("unknown op");
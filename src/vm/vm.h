@@ -2,42 +2,170 @@
 #define VM_H
 
 #define KB(B) (B * 1024)
+#define MB(B) (B * 1024 * 1024)
 
 #define MAX_STACK 128
 #define MAX_CALL 64
-#define MAX_MEM 64
+#define MAX_MEM KB(64)
 #define MAX_CALL 64
 #define MAX_FRAME 64
+#define MAX_REGION 64
+#define MAX_THREAD 64
+#define THREAD_STACK KB(64)
+#define FUEL_SLICE 1000
+
+#define MAP_BASE MAX_MEM
+#define MAP_SPACE MB(1024)
 
 #include "bin.h"
 #include "instr.h"
+#include "io.h"
+#include "native.h"
+#include "chan.h"
+#include "heap.h"
+#include "verify.h"
 #include "../common/hash.h"
+#include <pthread.h>
+#include <stdatomic.h>
 
 typedef struct vm_s vm_t;
 typedef struct call_s call_t;
+typedef struct region_s region_t;
+typedef struct thread_s thread_t;
+typedef struct proc_s proc_t;
+typedef struct par_s par_t;
 typedef enum int_code_e int_code_t;
+typedef enum mmap_flag_e mmap_flag_t;
+typedef enum vm_status_e vm_status_t;
 
 enum int_code_e {
   SYS_EXIT,
   SYS_PRINT,
-  SYS_WRITE
+  SYS_WRITE,
+  SYS_FLUSH,
+  SYS_READ,
+  SYS_READ_I32,
+  SYS_READ_LINE,
+  SYS_MMAP,
+  SYS_MUNMAP,
+  SYS_SPAWN,
+  SYS_JOIN,
+  SYS_CHAN,
+  SYS_SEND,
+  SYS_RECV,
+  SYS_CLOSE,
+  SYS_PARFOR,
+  SYS_ALLOC,
+  SYS_FREE,
+  SYS_REALLOC,
+  SYS_REGION_NEW,
+  SYS_REGION_ALLOC,
+  SYS_REGION_FREE,
+  MAX_SYS
+};
+
+enum mmap_flag_e {
+  MMAP_READ,
+  MMAP_COPY,
+  MMAP_ANON,
+  MMAP_HEAP
+};
+
+enum vm_status_e {
+  VM_EXIT,
+  VM_YIELD,
+  VM_BLOCK,
+  VM_WAIT,
+  VM_FUEL
+};
+
+struct region_s {
+  int addr;
+  int size;
+  mmap_flag_t flag;
+};
+
+struct thread_s {
+  vm_t *vm;
+  pthread_t handle;
+  int f_used;
+  int f_done;
+  int f_pool;
+  int result;
+};
+
+struct proc_s {
+  bin_t *bin;
+  verify_t verify;
+  char *mem;
+  region_t region[MAX_REGION];
+  int num_region;
+  io_t io;
+  thread_t thread[MAX_THREAD];
+  par_t *par;
+  heap_t heap;
+  chan_tbl_t chan;
+  atomic_int num_thread;
+  atomic_int budget;
+  atomic_int f_spent;
+  pthread_mutex_t lock;
+  pthread_mutex_t par_lock;
+  pthread_cond_t cond;
 };
 
 struct vm_s {
   bin_t *bin;
   int ip, sp, bp, cp, fp;
   int f_gtr, f_lss, f_equ, f_exit;
-  int mem[MAX_MEM];
-  int stack[MAX_STACK];
-  int call[MAX_CALL];
-  int frame[MAX_FRAME];
+  int f_block, f_wait, f_nonblock;
+  int f_main, f_par, f_stop;
+  int fuel;
+  int *stack;
+  int *call;
+  int *frame;
+  int stack_size, call_size, frame_size;
   int *s_i32;
   char *m_i8;
   int *m_i32;
+  proc_t *proc;
+  thread_t *thread;
+  int stack_addr;
+  vm_t *next;
 };
 
 vm_t *make_vm();
+vm_t *make_thread_vm(vm_t *parent, vfunc_t *func, int depth);
+void free_vm(vm_t *vm);
 void vm_load(vm_t *vm, bin_t *bin);
-void vm_exec(vm_t *vm);
+vm_status_t vm_exec(vm_t *vm, int fuel);
+
+proc_t *make_proc();
+void free_proc(proc_t *proc);
+int proc_lock(proc_t *proc);
+void proc_unlock(proc_t *proc, int locked);
+int proc_spawn(vm_t *vm, int entry, int arg);
+void proc_finish(vm_t *vm, vm_status_t status);
+int proc_is_done(proc_t *proc, int handle);
+int proc_all_done(proc_t *proc);
+int proc_join(proc_t *proc, int handle);
+void proc_join_all(proc_t *proc);
+
+char *mem_reserve();
+void mem_release(char *mem);
+int mem_map_file(vm_t *vm, const char *path, mmap_flag_t flag, int *size);
+int mem_unmap(vm_t *vm, int addr);
+int mem_map_stack(vm_t *vm, int size);
+void mem_unmap_stack(vm_t *vm, int addr);
+int mem_map_heap(vm_t *vm, int size);
+char *mem_str(vm_t *vm, int addr);
+int mem_is_readable(vm_t *vm, int addr, int len);
+int mem_is_writable(vm_t *vm, int addr, int len);
+
+int heap_alloc(vm_t *vm, int size);
+void heap_free(vm_t *vm, int ptr);
+int heap_realloc(vm_t *vm, int ptr, int size);
+int heap_region_new(vm_t *vm);
+int heap_region_alloc(vm_t *vm, int r, int size);
+void heap_region_free(vm_t *vm, int r);
 
 #endif